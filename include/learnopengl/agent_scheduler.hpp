@@ -0,0 +1,65 @@
+#ifndef AGENT_SCHEDULER_HPP
+#define AGENT_SCHEDULER_HPP
+
+#include <cmath>
+#include <cstdint>
+
+#include "agents.hpp"
+#include "timing_wheel.hpp"
+
+// Discrete-event driver for Agents. Instead of stepping every agent each
+// frame, an agent leaving a marker schedules its arrival in a timing wheel and
+// is not touched again until that arrival fires, when it immediately departs
+// for the next marker. Agents::positionAt() gives the position of an agent in
+// transit, so only the agents that are actually drawn are ever evaluated.
+// The cost of a frame depends on the number of arrivals, not on the number of
+// agents, which also lets the simulation run much faster than real time.
+class AgentScheduler
+{
+public:
+    // simulation seconds since start()
+    double time = 0.0;
+    // simulation seconds per real second
+    float timeScale = 1.0f;
+    // resolution of the wheel in simulation seconds
+    const double tickLength;
+
+    AgentScheduler(Agents &agents, double tickLength = 0.001) : tickLength(tickLength), agents(agents)
+    {
+    }
+
+    void start()
+    {
+        wheel.resize(agents.size());
+        for (size_t i = 0; i < agents.size(); i++)
+            departAndSchedule(i, time);
+    }
+
+    void update(float deltaTime)
+    {
+        time += deltaTime * timeScale;
+        wheel.advance(toTick(time), [this](uint32_t i) {
+            agents.arrive(i);
+            // chain from the exact arrival time, not from the frame time
+            departAndSchedule(i, agents.arrivalTime[i]);
+        });
+    }
+
+    size_t inTransit() const { return wheel.size(); }
+
+private:
+    Agents &agents;
+    TimingWheel wheel;
+
+    uint64_t toTick(double t) const { return (uint64_t)std::ceil(t / tickLength); }
+
+    void departAndSchedule(size_t i, double now)
+    {
+        double arrival = agents.depart(i, now);
+        // agents on markers without neighbours stay idle and never get scheduled
+        if (arrival >= 0.0)
+            wheel.schedule((uint32_t)i, toTick(arrival));
+    }
+};
+
+#endif
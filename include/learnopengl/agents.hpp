@@ -0,0 +1,228 @@
+#ifndef AGENTS_HPP
+#define AGENTS_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "frustum.hpp"
+#include "marker.hpp"
+#include "spline_paths.hpp"
+
+// A crowd of simple map figures that wander across the marker graph.
+// Data is kept as parallel arrays (one entry per agent) so that the per-tick
+// passes over it stay cache friendly even with very large agent counts.
+//
+// Agents are also kept in buckets by currentMarker. An agent never gets
+// further from its currentMarker than the longest path that left that marker
+// so far (a path of length L ends within L of where it starts), so
+// forEachVisible() can skip the agents of a marker whose neighbourhood is out
+// of view without looking at them.
+class Agents
+{
+public:
+    std::vector<glm::vec3> position;
+    std::vector<int> currentMarker;
+    // -1 while the agent is standing on currentMarker
+    std::vector<int> targetMarker;
+    // world units per second
+    float movementSpeed = 1.0f;
+
+    // event-driven movement (see AgentScheduler), in simulation seconds; the
+    // position of a travelling agent is derived from these when needed
+    std::vector<double> departureTime;
+    std::vector<double> arrivalTime;
+
+    // when set, event-driven agents follow smooth curves through the markers
+    // instead of straight lines; previousMarker/nextMarker pick the curve
+    const SplinePaths *paths = nullptr;
+    std::vector<int> previousMarker;
+    std::vector<int> nextMarker;
+    std::vector<uint32_t> pathSegment;
+
+    Agents(std::vector<Marker> &markers) : markers(markers)
+    {
+    }
+
+    size_t size() const { return position.size(); }
+
+    void spawn(int markerIdx)
+    {
+        if (buckets.size() < markers.size())
+        {
+            buckets.resize(markers.size());
+            reach.resize(markers.size(), 0.0f);
+        }
+        bucketSlot.push_back(buckets[markerIdx].size());
+        buckets[markerIdx].push_back(position.size());
+        position.push_back(markers[markerIdx].position);
+        currentMarker.push_back(markerIdx);
+        targetMarker.push_back(-1);
+        departureTime.push_back(0.0);
+        arrivalTime.push_back(0.0);
+        previousMarker.push_back(-1);
+        nextMarker.push_back(-1);
+        pathSegment.push_back(0);
+    }
+
+    void spawnRandom(size_t count)
+    {
+        reserve(size() + count);
+        for (size_t i = 0; i < count; i++)
+            spawn(rand() % markers.size());
+    }
+
+    void reserve(size_t count)
+    {
+        position.reserve(count);
+        currentMarker.reserve(count);
+        targetMarker.reserve(count);
+        departureTime.reserve(count);
+        arrivalTime.reserve(count);
+        previousMarker.reserve(count);
+        nextMarker.reserve(count);
+        pathSegment.reserve(count);
+        bucketSlot.reserve(count);
+    }
+
+    // every idle agent picks a random neighbour of its marker and starts moving
+    void setRandomMovementTargets()
+    {
+        for (size_t i = 0; i < size(); i++)
+        {
+            if (targetMarker[i] == -1)
+            {
+                targetMarker[i] = randomNeighbour(currentMarker[i]);
+                if (targetMarker[i] != -1)
+                    extendReach(currentMarker[i], glm::length(markers[targetMarker[i]].position -
+                                                              markers[currentMarker[i]].position));
+            }
+        }
+    }
+
+    // starts moving agent i towards a random neighbour at time now and returns
+    // its arrival time, or -1 if its marker has no neighbours
+    double depart(size_t i, double now)
+    {
+        int from = currentMarker[i];
+        targetMarker[i] = nextMarker[i] != -1 ? nextMarker[i] : randomNeighbour(from);
+        nextMarker[i] = -1;
+        if (targetMarker[i] == -1)
+            return -1.0;
+
+        float distance;
+        if (paths)
+        {
+            // the curve depends on the marker after the target, so choose it now
+            nextMarker[i] = randomNeighbour(targetMarker[i]);
+            pathSegment[i] = paths->segmentIndex(previousMarker[i], from, targetMarker[i], nextMarker[i]);
+            distance = paths->segments[pathSegment[i]].length;
+        }
+        else
+        {
+            distance = glm::length(markers[targetMarker[i]].position - markers[from].position);
+        }
+        extendReach(from, distance);
+        departureTime[i] = now;
+        arrivalTime[i] = now + distance / movementSpeed;
+        return arrivalTime[i];
+    }
+
+    void arrive(size_t i)
+    {
+        previousMarker[i] = currentMarker[i];
+        moveToBucket(i, targetMarker[i]);
+        targetMarker[i] = -1;
+        position[i] = markers[currentMarker[i]].position;
+    }
+
+    // position of an event-driven agent at time now
+    glm::vec3 positionAt(size_t i, double now) const
+    {
+        glm::vec3 from = markers[currentMarker[i]].position;
+        if (targetMarker[i] == -1)
+            return from;
+        if (paths)
+            return paths->evaluate(pathSegment[i], (float)((now - departureTime[i]) * movementSpeed));
+        double duration = arrivalTime[i] - departureTime[i];
+        float t = duration > 0.0 ? (float)((now - departureTime[i]) / duration) : 1.0f;
+        return glm::mix(from, markers[targetMarker[i]].position, glm::clamp(t, 0.0f, 1.0f));
+    }
+
+    void processMovement(float deltaTime)
+    {
+        float step = movementSpeed * deltaTime;
+        for (size_t i = 0; i < size(); i++)
+        {
+            if (targetMarker[i] == -1)
+                continue;
+
+            glm::vec3 target = markers[targetMarker[i]].position;
+            glm::vec2 dirVec = glm::vec2(target.x - position[i].x, target.z - position[i].z);
+            float distance = glm::length(dirVec);
+
+            if (distance <= step)
+            {
+                previousMarker[i] = currentMarker[i];
+                moveToBucket(i, targetMarker[i]);
+                targetMarker[i] = -1;
+                position[i] = target;
+            }
+            else
+            {
+                dirVec *= step / distance;
+                position[i].x += dirVec.x;
+                position[i].z += dirVec.y;
+            }
+        }
+    }
+
+    // calls visit(i) for every agent that may be inside frustum, or within
+    // margin of it; the others are not touched
+    template <typename Visit> void forEachVisible(const Frustum &frustum, float margin, Visit visit) const
+    {
+        for (size_t marker = 0; marker < buckets.size(); marker++)
+        {
+            if (buckets[marker].empty() ||
+                !frustum.intersectsSphere(glm::vec4(markers[marker].position, reach[marker] + margin)))
+                continue;
+            for (uint32_t i : buckets[marker])
+                visit(i);
+        }
+    }
+
+private:
+    std::vector<Marker> &markers;
+    // agents by currentMarker, and where each agent is in its bucket
+    std::vector<std::vector<uint32_t>> buckets;
+    std::vector<uint32_t> bucketSlot;
+    // per marker, the longest path that left it
+    std::vector<float> reach;
+
+    void extendReach(int marker, float distance) { reach[marker] = std::max(reach[marker], distance); }
+
+    void moveToBucket(size_t i, int marker)
+    {
+        std::vector<uint32_t> &old = buckets[currentMarker[i]];
+        // the last agent of the bucket takes the place of i
+        old[bucketSlot[i]] = old.back();
+        bucketSlot[old.back()] = bucketSlot[i];
+        old.pop_back();
+        bucketSlot[i] = buckets[marker].size();
+        buckets[marker].push_back(i);
+        currentMarker[i] = marker;
+    }
+
+    int randomNeighbour(int markerIdx) const
+    {
+        const Marker &current = markers[markerIdx];
+        if (current.neighbours.empty())
+            return -1;
+        return current.neighbours[rand() % current.neighbours.size()].idx;
+    }
+};
+
+#endif
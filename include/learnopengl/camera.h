@@ -102,6 +102,16 @@ public:
         updateCameraVectors();
     }
 
+    // places the camera at position, looking at target (for scripted camera paths)
+    void LookAt(glm::vec3 position, glm::vec3 target)
+    {
+        Position = position;
+        glm::vec3 direction = glm::normalize(target - position);
+        Yaw = glm::degrees(atan2(direction.z, direction.x));
+        Pitch = glm::degrees(asin(direction.y));
+        updateCameraVectors();
+    }
+
     // processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
     void ProcessMouseScroll(float yoffset)
     {
@@ -0,0 +1,322 @@
+#ifndef CLUSTERED_LIGHTS_HPP
+#define CLUSTERED_LIGHTS_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CLUSTERED_LIGHTS_SSE2 1
+#endif
+
+// A point light that only reaches radius world units.
+struct ClusterLight
+{
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+    float pad0;
+};
+
+// Clustered forward shading: the view frustum is cut into TILES_X x TILES_Y
+// screen tiles and SLICES exponentially spaced depth slices, and every
+// cluster lists the lights whose sphere reaches it. The fragment shaders find
+// their cluster from gl_FragCoord and the view depth and only loop over its
+// list, so hundreds of small lights cost about as much per pixel as the few
+// that overlap it.
+//
+// Lists are built on the CPU each frame. The side planes of the tiles pass
+// through the eye, so they are the same for every slice: a light's range of
+// tiles is the number of tile planes its sphere is completely to one side
+// of, counted for four lights at once with SSE2. Its slices come from the
+// depth range of the sphere. The lights of each cluster are then collected
+// with a counting sort.
+//
+// GL 3.3 has no storage buffers, the data goes to the shaders as buffer
+// textures: the lights as two RGBA32F texels each (position and radius,
+// color), the (first, count) range of every cluster as RG32UI and the light
+// indices the ranges point into as R16UI.
+class ClusteredLights
+{
+public:
+    enum
+    {
+        TILES_X = 16,
+        TILES_Y = 9,
+        SLICES = 24,
+        CLUSTER_COUNT = TILES_X * TILES_Y * SLICES,
+        // indices are 16 bit
+        MAX_LIGHTS = 65535
+    };
+
+    // all lights, in world space; change them freely between build() calls
+    std::vector<ClusterLight> lights;
+
+    struct Stats
+    {
+        unsigned int lights = 0;
+        // lights reaching into the frustum, and entries in all cluster lists
+        unsigned int visible = 0;
+        unsigned int indices = 0;
+        // CPU time of build()
+        float milliseconds = 0.0f;
+    };
+    Stats stats;
+
+    ClusteredLights()
+    {
+        glGenBuffers(BUFFER_COUNT, buffers);
+        glGenTextures(BUFFER_COUNT, textures);
+        const GLenum formats[BUFFER_COUNT] = {GL_RGBA32F, GL_RG32UI, GL_R16UI};
+        for (int i = 0; i < BUFFER_COUNT; i++)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            // buffer textures need storage before they can be sampled
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // assigns the lights to the clusters of the camera and uploads the lists
+    void build(const glm::mat4 &view, const glm::mat4 &projection, float nearPlane, float farPlane)
+    {
+        auto start = std::chrono::steady_clock::now();
+        this->nearPlane = nearPlane;
+        this->farPlane = farPlane;
+        size_t count = std::min<size_t>(lights.size(), MAX_LIGHTS);
+        stats = Stats();
+        stats.lights = count;
+
+        // view space spheres, padded to a multiple of four
+        size_t padded = (count + 3) & ~size_t(3);
+        x.assign(padded, 0.0f);
+        y.assign(padded, 0.0f);
+        z.assign(padded, 0.0f);
+        radius.assign(padded, -1.0f);
+        for (size_t i = 0; i < count; i++)
+        {
+            glm::vec3 position = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+            x[i] = position.x;
+            y[i] = position.y;
+            z[i] = position.z;
+            radius[i] = lights[i].radius;
+        }
+        ranges.resize(padded);
+        tileRanges(1.0f / projection[0][0], 1.0f / projection[1][1], padded);
+
+        // clusters of every light, counted and then filled in
+        clusterCounts.assign(CLUSTER_COUNT + 1, 0);
+        for (size_t i = 0; i < count; i++)
+        {
+            LightRange &range = ranges[i];
+            float depth = -z[i];
+            if (range.x0 > range.x1 || range.y0 > range.y1 || depth + radius[i] < nearPlane ||
+                depth - radius[i] > farPlane)
+            {
+                range.z0 = 1;
+                range.z1 = 0;
+                continue;
+            }
+            range.z0 = slice(depth - radius[i]);
+            range.z1 = slice(depth + radius[i]);
+            stats.visible++;
+            forEachCluster(range, [&](unsigned int cluster) { clusterCounts[cluster + 1]++; });
+        }
+        for (unsigned int c = 0; c < CLUSTER_COUNT; c++)
+            clusterCounts[c + 1] += clusterCounts[c];
+        stats.indices = clusterCounts[CLUSTER_COUNT];
+        indices.resize(stats.indices);
+        clusterRanges.resize(CLUSTER_COUNT * 2);
+        for (unsigned int c = 0; c < CLUSTER_COUNT; c++)
+        {
+            clusterRanges[c * 2] = clusterCounts[c];
+            clusterRanges[c * 2 + 1] = 0;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            forEachCluster(ranges[i], [&](unsigned int cluster) {
+                uint32_t &filled = clusterRanges[cluster * 2 + 1];
+                indices[clusterRanges[cluster * 2] + filled++] = (uint16_t)i;
+            });
+        }
+
+        upload(buffers[BUFFER_LIGHTS], lights.data(), count * sizeof(ClusterLight));
+        upload(buffers[BUFFER_CLUSTERS], clusterRanges.data(), clusterRanges.size() * sizeof(uint32_t));
+        upload(buffers[BUFFER_INDICES], indices.data(), indices.size() * sizeof(uint16_t));
+
+        stats.milliseconds =
+            std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // binds the buffer textures to unit, unit + 1 and unit + 2, for the
+    // samplers clusterLights, clusterRanges and clusterIndices
+    void bind(int unit) const
+    {
+        for (int i = 0; i < BUFFER_COUNT; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // what the shaders need to find their cluster: tiles and slices per
+    // axis with the light count in w, and in scale xy tiles per pixel for a
+    // viewport of width x height, zw turning log(view depth) into a slice
+    glm::ivec4 gridUniform() const { return glm::ivec4(TILES_X, TILES_Y, SLICES, stats.lights); }
+
+    glm::vec4 scaleUniform(float width, float height) const
+    {
+        float logRange = std::log(farPlane / nearPlane);
+        return glm::vec4(TILES_X / width, TILES_Y / height, SLICES / logRange,
+                         -SLICES * std::log(nearPlane) / logRange);
+    }
+
+private:
+    enum
+    {
+        BUFFER_LIGHTS,
+        BUFFER_CLUSTERS,
+        BUFFER_INDICES,
+        BUFFER_COUNT
+    };
+
+    // clusters a light reaches, inclusive
+    struct LightRange
+    {
+        int x0, x1, y0, y1, z0, z1;
+    };
+
+    unsigned int buffers[BUFFER_COUNT];
+    unsigned int textures[BUFFER_COUNT];
+    float nearPlane = 0.1f, farPlane = 100.0f;
+    std::vector<float> x, y, z, radius;
+    std::vector<LightRange> ranges;
+    std::vector<uint32_t> clusterCounts;
+    // (first index, count) of every cluster
+    std::vector<uint32_t> clusterRanges;
+    std::vector<uint16_t> indices;
+
+    int slice(float depth) const
+    {
+        depth = glm::clamp(depth, nearPlane, farPlane);
+        int s = (int)(std::log(depth / nearPlane) / std::log(farPlane / nearPlane) * SLICES);
+        return std::min(std::max(s, 0), SLICES - 1);
+    }
+
+    template <typename F>
+    static void forEachCluster(const LightRange &range, F f)
+    {
+        for (int cz = range.z0; cz <= range.z1; cz++)
+            for (int cy = range.y0; cy <= range.y1; cy++)
+                for (int cx = range.x0; cx <= range.x1; cx++)
+                    f((cz * TILES_Y + cy) * TILES_X + cx);
+    }
+
+    // tiles in x and y every sphere overlaps; tanX and tanY are the tangents
+    // of the half field of view
+    void tileRanges(float tanX, float tanY, size_t padded)
+    {
+        // tile boundary i in NDC is b = -1 + 2i / tiles, 0 and tiles being
+        // the sides of the frustum; a view space point is right of (above) it
+        // if p.x + b * tan * p.z >= 0, and the plane normal (1, 0, b * tan) is
+        // normalized for sphere distances
+        float normalX[TILES_X + 1][2], normalY[TILES_Y + 1][2];
+        for (int i = 0; i <= TILES_X; i++)
+        {
+            float slope = (-1.0f + 2.0f * i / TILES_X) * tanX;
+            float length = std::sqrt(1.0f + slope * slope);
+            normalX[i][0] = 1.0f / length;
+            normalX[i][1] = slope / length;
+        }
+        for (int i = 0; i <= TILES_Y; i++)
+        {
+            float slope = (-1.0f + 2.0f * i / TILES_Y) * tanY;
+            float length = std::sqrt(1.0f + slope * slope);
+            normalY[i][0] = 1.0f / length;
+            normalY[i][1] = slope / length;
+        }
+
+#ifdef CLUSTERED_LIGHTS_SSE2
+        for (size_t i = 0; i < padded; i += 4)
+        {
+            __m128 px = _mm_loadu_ps(&x[i]), py = _mm_loadu_ps(&y[i]), pz = _mm_loadu_ps(&z[i]);
+            __m128 r = _mm_loadu_ps(&radius[i]);
+            __m128 negativeR = _mm_sub_ps(_mm_setzero_ps(), r);
+            // comparison masks are -1 where true, subtracting them counts
+            __m128i rightOf = _mm_setzero_si128(), leftOf = _mm_setzero_si128();
+            __m128i above = _mm_setzero_si128(), below = _mm_setzero_si128();
+            for (int b = 0; b <= TILES_X; b++)
+            {
+                __m128 distance = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(normalX[b][0])),
+                                             _mm_mul_ps(pz, _mm_set1_ps(normalX[b][1])));
+                rightOf = _mm_sub_epi32(rightOf, _mm_castps_si128(_mm_cmpgt_ps(distance, r)));
+                leftOf = _mm_sub_epi32(leftOf, _mm_castps_si128(_mm_cmplt_ps(distance, negativeR)));
+            }
+            for (int b = 0; b <= TILES_Y; b++)
+            {
+                __m128 distance = _mm_add_ps(_mm_mul_ps(py, _mm_set1_ps(normalY[b][0])),
+                                             _mm_mul_ps(pz, _mm_set1_ps(normalY[b][1])));
+                above = _mm_sub_epi32(above, _mm_castps_si128(_mm_cmpgt_ps(distance, r)));
+                below = _mm_sub_epi32(below, _mm_castps_si128(_mm_cmplt_ps(distance, negativeR)));
+            }
+            int32_t counts[4][4];
+            _mm_storeu_si128((__m128i *)counts[0], rightOf);
+            _mm_storeu_si128((__m128i *)counts[1], leftOf);
+            _mm_storeu_si128((__m128i *)counts[2], above);
+            _mm_storeu_si128((__m128i *)counts[3], below);
+            for (int lane = 0; lane < 4; lane++)
+                setTileRange(ranges[i + lane], counts[0][lane], counts[1][lane], counts[2][lane], counts[3][lane]);
+        }
+#else
+        for (size_t i = 0; i < padded; i++)
+        {
+            int rightOf = 0, leftOf = 0, above = 0, below = 0;
+            for (int b = 0; b <= TILES_X; b++)
+            {
+                float distance = x[i] * normalX[b][0] + z[i] * normalX[b][1];
+                rightOf += distance > radius[i];
+                leftOf += distance < -radius[i];
+            }
+            for (int b = 0; b <= TILES_Y; b++)
+            {
+                float distance = y[i] * normalY[b][0] + z[i] * normalY[b][1];
+                above += distance > radius[i];
+                below += distance < -radius[i];
+            }
+            setTileRange(ranges[i], rightOf, leftOf, above, below);
+        }
+#endif
+    }
+
+    // a sphere completely right of the first rightOf boundaries starts in
+    // tile rightOf - 1, one right of all of them is outside the frustum
+    static void setTileRange(LightRange &range, int rightOf, int leftOf, int above, int below)
+    {
+        range.x0 = std::max(rightOf - 1, 0);
+        range.x1 = std::min(TILES_X - leftOf, TILES_X - 1);
+        range.y0 = std::max(above - 1, 0);
+        range.y1 = std::min(TILES_Y - below, TILES_Y - 1);
+    }
+
+    static void upload(unsigned int buffer, const void *data, size_t size)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        // orphaned every frame, the driver hands out fresh storage
+        glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(size, 16), nullptr, GL_STREAM_DRAW);
+        if (size)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+};
+
+#endif
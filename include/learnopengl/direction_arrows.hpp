@@ -0,0 +1,141 @@
+#ifndef DIRECTION_ARROWS_HPP
+#define DIRECTION_ARROWS_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "marker.hpp"
+#include "render_queue.hpp"
+#include "shader.h"
+
+// An arrow lying on the ground next to a marker for each of its outgoing
+// edges, pointing along the edge. All arrows are one instanced draw of a
+// textured quad; every instance has a model matrix (attribute locations 5 to
+// 8) and a tint (location 9), see arrowShader.vs. The instance buffer is
+// only rebuilt when update() gets another marker than last time.
+//
+// The edges are read from the marker list itself: the neighbours of a
+// Marker are copies made while the graph was loaded, and their own
+// neighbour lists may be incomplete.
+class DirectionArrows
+{
+public:
+    // distance from the marker to the arrow's center, at most half the edge
+    float distance = 0.7f;
+    float size = 0.3f;
+    // arrows to markers with no way on other than back
+    glm::vec4 tint = glm::vec4(1.0f);
+    glm::vec4 deadEndTint = glm::vec4(1.0f, 0.45f, 0.35f, 1.0f);
+
+    unsigned int count = 0;
+
+    DirectionArrows(unsigned int texture) : texture(texture)
+    {
+        // a unit quad in the xy plane, the texture's arrow pointing to +y
+        float vertices[] = {
+            // positions          // texture coords
+            0.5f,  0.5f,  0.0f, 1.0f, 1.0f, // top right
+            0.5f,  -0.5f, 0.0f, 1.0f, 0.0f, // bottom right
+            -0.5f, -0.5f, 0.0f, 0.0f, 0.0f, // bottom left
+            -0.5f, 0.5f,  0.0f, 0.0f, 1.0f  // top left
+        };
+        unsigned int indices[] = {
+            0, 1, 3, // first triangle
+            1, 2, 3  // second triangle
+        };
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glGenBuffers(1, &instanceVBO);
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        // a mat4 attribute takes four vec4 locations
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            glEnableVertexAttribArray(5 + i);
+            glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                                  (void *)(i * sizeof(glm::vec4)));
+            glVertexAttribDivisor(5 + i, 1);
+        }
+        glEnableVertexAttribArray(9);
+        glVertexAttribPointer(9, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void *)sizeof(glm::mat4));
+        glVertexAttribDivisor(9, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // arrows for the edges of markers[index]
+    void update(const std::vector<Marker> &markers, int index)
+    {
+        if (index == currentIndex)
+            return;
+        currentIndex = index;
+        instances.clear();
+        const Marker &marker = markers[index];
+        for (const Marker &edge : marker.neighbours)
+        {
+            const Marker &neighbour = markers[edge.idx];
+            glm::vec3 offset = neighbour.position - marker.position;
+            offset.y = 0.0f;
+            float length = glm::length(offset);
+            if (length <= 0.0f)
+                continue;
+            glm::vec3 direction = offset / length;
+
+            // lay the quad flat with the arrow to +z, then turn it around y
+            // towards the neighbour
+            glm::vec3 position = marker.position + direction * std::min(distance, length * 0.5f);
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+            model = glm::rotate(model, std::atan2(direction.x, direction.z), glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::scale(model, glm::vec3(size));
+            model = glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+
+            Instance instance;
+            instance.model = model;
+            instance.tint = neighbour.neighbours.size() > 1 ? tint : deadEndTint;
+            instances.push_back(instance);
+        }
+        count = instances.size();
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void submit(RenderQueue &queue, Shader &shader)
+    {
+        // transparent texels are discarded, so arrows can go with the opaque
+        // items
+        queue.submitInstanced(shader, VAO, 6, GL_TEXTURE_2D, texture, count);
+    }
+
+private:
+    struct Instance
+    {
+        glm::mat4 model;
+        glm::vec4 tint;
+    };
+
+    unsigned int texture;
+    unsigned int VAO = 0, VBO = 0, EBO = 0, instanceVBO = 0;
+    int currentIndex = -1;
+    std::vector<Instance> instances;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef DYNAMIC_RESOLUTION_HPP
+#define DYNAMIC_RESOLUTION_HPP
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+
+// Renders the scene into an offscreen framebuffer at a fraction of the
+// window's resolution and scales it up to the window, so that the frame's
+// GPU time stays within targetMilliseconds.
+//
+// The framebuffer has the window's full size and the scene is drawn into its
+// lower left width() x height() corner, so changing the scale reallocates
+// nothing. update() adjusts the scale with a PI controller: the pixel count
+// (scale squared, what the per-pixel cost goes with) is set from the relative
+// error of the measured GPU time, proportionally for quick reactions and
+// integrated for the level that settles at the target. GPU times arrive a
+// few frames late (see GpuTimer), which the small integral gain allows for.
+class DynamicResolution
+{
+public:
+    // limits of the scale per axis, and the GPU time per frame to aim for
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    float targetMilliseconds = 16.0f;
+    // controller gains, per frame, on the pixel fraction
+    float proportionalGain = 0.3f;
+    float integralGain = 0.02f;
+    // the scale moves in steps of this, so it doesn't change every frame by
+    // a fraction of a pixel
+    float step = 1.0f / 32.0f;
+    // GPU time this much (relative) under the target is left alone
+    float tolerance = 0.15f;
+    bool enabled = true;
+
+    unsigned int FBO = 0;
+    unsigned int colorTexture = 0;
+    float scale = 1.0f;
+
+    DynamicResolution(unsigned int windowWidth, unsigned int windowHeight)
+    {
+        glGenFramebuffers(1, &FBO);
+        glGenTextures(1, &colorTexture);
+        glGenRenderbuffers(1, &depthStencil);
+        resize(windowWidth, windowHeight);
+    }
+
+    // to the window's framebuffer size; nothing happens when it is unchanged
+    // or 0 (a minimized window)
+    void resize(unsigned int windowWidth, unsigned int windowHeight)
+    {
+        if (!windowWidth || !windowHeight || (windowWidth == fullWidth && windowHeight == fullHeight))
+            return;
+        fullWidth = windowWidth;
+        fullHeight = windowHeight;
+        glBindTexture(GL_TEXTURE_2D, colorTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, fullWidth, fullHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, fullWidth, fullHeight);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencil);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // size of the scene in pixels at the current scale
+    unsigned int width() const { return std::max(1u, (unsigned int)std::lround(fullWidth * scale)); }
+    unsigned int height() const { return std::max(1u, (unsigned int)std::lround(fullHeight * scale)); }
+
+    // picks the scale of the next frame from the GPU time of a recent one
+    void update(float gpuMilliseconds)
+    {
+        float minPixels = minScale * minScale, maxPixels = maxScale * maxScale;
+        if (!enabled || gpuMilliseconds <= 0.0f)
+        {
+            if (!enabled)
+            {
+                scale = maxScale;
+                integral = maxPixels;
+            }
+            return;
+        }
+        // positive with time to spare. A little time to spare counts as on
+        // target: a scale step changes the time by a few percent, and the
+        // integral would otherwise keep stepping over the target and back.
+        float error = (targetMilliseconds - gpuMilliseconds) / targetMilliseconds;
+        if (error >= 0.0f && error < tolerance)
+            error = 0.0f;
+        // clamped, so time spent at a limit doesn't wind it up
+        integral = std::min(std::max(integral + integralGain * error, minPixels), maxPixels);
+        float pixels = std::min(std::max(integral + proportionalGain * error, minPixels), maxPixels);
+        // only when clearly past the next step, not back and forth between
+        // two steps around the target
+        float wanted = std::sqrt(pixels);
+        if (std::fabs(wanted - scale) > step * 0.75f)
+            scale = std::min(std::max(std::round(wanted / step) * step, minScale), maxScale);
+    }
+
+    // the scene draws into the offscreen framebuffer from here on
+    void begin()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, width(), height());
+    }
+
+    // scales the scene up to the window and leaves the window's framebuffer
+    // bound with its full viewport, for the UI
+    void present()
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, width(), height(), 0, 0, fullWidth, fullHeight, GL_COLOR_BUFFER_BIT,
+                          width() == fullWidth && height() == fullHeight ? GL_NEAREST : GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, fullWidth, fullHeight);
+    }
+
+private:
+    unsigned int depthStencil = 0;
+    unsigned int fullWidth = 0, fullHeight = 0;
+    // pixel fraction the controller settles at
+    float integral = 1.0f;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef FRAME_PROFILER_HPP
+#define FRAME_PROFILER_HPP
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gpu_timer.hpp"
+
+// CPU and GPU time of the named sections of a frame, kept for the last
+// HISTORY frames for graphs and export.
+//
+// begin()/end() measure CPU time with steady_clock, adding up if a section
+// is entered more than once a frame. Sections added with gpu set also run a
+// GpuTimer, so its rules apply: at most once a frame, never overlapping
+// another GPU section or timer, and the GPU times are a few frames old
+// instead of stalling on the query results. Work timed by a GpuTimer of its
+// own (like RenderQueue's passes) reports through setGpu() instead.
+class FrameProfiler
+{
+public:
+    enum
+    {
+        HISTORY = 240
+    };
+
+    struct Section
+    {
+        std::string name;
+        bool gpu;
+        // milliseconds per frame, oldest at FrameProfiler::next
+        float cpuHistory[HISTORY] = {0.0f};
+        float gpuHistory[HISTORY] = {0.0f};
+        // of the frame being measured
+        float cpu = 0.0f, gpuValue = 0.0f;
+        std::chrono::steady_clock::time_point start;
+        GpuTimer timer;
+        bool timed = false;
+    };
+
+    // enters a section for its lifetime
+    class Scope
+    {
+    public:
+        Scope(FrameProfiler &profiler, unsigned int section) : profiler(profiler), section(section)
+        {
+            profiler.begin(section);
+        }
+        ~Scope() { profiler.end(section); }
+
+    private:
+        FrameProfiler &profiler;
+        unsigned int section;
+    };
+
+    std::vector<Section> sections;
+    // history slot the next frame goes to, and frames recorded so far
+    unsigned int next = 0;
+    unsigned long frames = 0;
+
+    // adds a section, returns its id; add all of them before measuring
+    unsigned int add(const char *name, bool gpu = false)
+    {
+        sections.push_back(Section());
+        sections.back().name = name;
+        sections.back().gpu = gpu;
+        return sections.size() - 1;
+    }
+
+    void begin(unsigned int id)
+    {
+        Section &section = sections[id];
+        if (section.gpu)
+            section.timer.begin();
+        section.start = std::chrono::steady_clock::now();
+    }
+
+    void end(unsigned int id)
+    {
+        Section &section = sections[id];
+        section.cpu +=
+            std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - section.start).count();
+        if (section.gpu)
+        {
+            section.timer.end();
+            section.timed = true;
+        }
+    }
+
+    // GPU time of the section measured elsewhere, for this frame
+    void setGpu(unsigned int id, float milliseconds) { sections[id].gpuValue = milliseconds; }
+
+    // moves this frame's times into the history
+    void endFrame()
+    {
+        for (Section &section : sections)
+        {
+            section.cpuHistory[next] = section.cpu;
+            // not run this frame, no new GPU time either
+            if (section.gpu)
+                section.gpuValue = section.timed ? section.timer.milliseconds : 0.0f;
+            section.gpuHistory[next] = section.gpuValue;
+            section.cpu = section.gpuValue = 0.0f;
+            section.timed = false;
+        }
+        next = (next + 1) % HISTORY;
+        frames++;
+    }
+
+    // the last recorded frame, or the average of the history
+    float lastCpu(unsigned int id) const { return sections[id].cpuHistory[last()]; }
+    float lastGpu(unsigned int id) const { return sections[id].gpuHistory[last()]; }
+
+    float averageCpu(unsigned int id) const { return average(sections[id].cpuHistory); }
+    float averageGpu(unsigned int id) const { return average(sections[id].gpuHistory); }
+
+    // writes the history as CSV, one row per frame, oldest first
+    bool exportCsv(const char *path) const
+    {
+        std::ofstream file(path);
+        if (!file)
+            return false;
+        file << "frame";
+        for (const Section &section : sections)
+            file << "," << section.name << " CPU ms," << section.name << " GPU ms";
+        file << "\n";
+        unsigned int count = recorded();
+        for (unsigned int i = 0; i < count; i++)
+        {
+            unsigned int slot = (next + HISTORY - count + i) % HISTORY;
+            file << frames - count + i;
+            for (const Section &section : sections)
+                file << "," << section.cpuHistory[slot] << "," << section.gpuHistory[slot];
+            file << "\n";
+        }
+        return (bool)file;
+    }
+
+private:
+    unsigned int last() const { return (next + HISTORY - 1) % HISTORY; }
+    unsigned int recorded() const { return frames < HISTORY ? (unsigned int)frames : (unsigned int)HISTORY; }
+
+    float average(const float *history) const
+    {
+        unsigned int count = recorded();
+        if (!count)
+            return 0.0f;
+        float sum = 0.0f;
+        for (unsigned int i = 0; i < count; i++)
+            sum += history[(next + HISTORY - 1 - i) % HISTORY];
+        return sum / count;
+    }
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef FRAME_UNIFORMS_HPP
+#define FRAME_UNIFORMS_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstring>
+
+#include "shader.h"
+
+// Data shared by all shaders, uploaded once per frame into uniform buffers
+// bound at fixed binding points. The structs mirror the std140 layout of the
+// FrameData and Lights blocks declared in the shaders: every vec3 starts a
+// new 16 byte slot and a following float fills its last 4 bytes.
+
+const unsigned int FRAME_DATA_BINDING = 0;
+const unsigned int LIGHTS_BINDING = 1;
+
+struct FrameData
+{
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec3 viewPos;
+    float pad0;
+};
+
+struct DirLightData
+{
+    glm::vec3 direction;
+    float pad0;
+    glm::vec3 ambient;
+    float pad1;
+    glm::vec3 diffuse;
+    float pad2;
+    glm::vec3 specular;
+    float pad3;
+};
+
+struct PointLightData
+{
+    glm::vec3 position;
+    float constant;
+    glm::vec3 ambient;
+    float linear;
+    glm::vec3 diffuse;
+    float quadratic;
+    glm::vec3 specular;
+    // range of its shadow map, 0 without shadows
+    float shadowFarPlane;
+};
+
+struct SpotLightData
+{
+    glm::vec3 position;
+    float cutOff;
+    glm::vec3 direction;
+    float outerCutOff;
+    glm::vec3 ambient;
+    float constant;
+    glm::vec3 diffuse;
+    float linear;
+    float quadratic;
+    float pad0[3];
+};
+
+struct LightsData
+{
+    // light on the models
+    DirLightData dirLight;
+    // the same light, dimmer on the map
+    DirLightData mapDirLight;
+    PointLightData pointLight;
+    SpotLightData spotLight;
+    // directional light shadows, see ShadowCascades
+    glm::mat4 cascadeMatrices[3];
+    // view depth where each cascade ends, w is 1 when shadows are on
+    glm::vec4 cascadeSplits;
+    // clustered lights, see ClusteredLights::gridUniform and scaleUniform
+    glm::ivec4 clusterGrid;
+    glm::vec4 clusterScale;
+};
+
+// A uniform buffer holding one T, bound to binding for the whole program run.
+// upload() skips the transfer when the contents did not change.
+template <typename T>
+class UniformBuffer
+{
+public:
+    T data;
+
+    UniformBuffer(unsigned int binding)
+    {
+        // padding included, upload() compares raw bytes
+        std::memset(static_cast<void *>(&data), 0, sizeof(T));
+        std::memset(static_cast<void *>(&uploaded), 0, sizeof(T));
+        glGenBuffers(1, &UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), &data, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, UBO);
+    }
+
+    void upload()
+    {
+        if (std::memcmp(&data, &uploaded, sizeof(T)) == 0)
+            return;
+        uploaded = data;
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+private:
+    unsigned int UBO;
+    T uploaded;
+};
+
+// connects the FrameData and Lights blocks of a program (if it has them) to
+// the fixed binding points
+inline void bindFrameUniforms(Shader &shader)
+{
+    shader.bindUniformBlock("FrameData", FRAME_DATA_BINDING);
+    shader.bindUniformBlock("Lights", LIGHTS_BINDING);
+}
+
+#endif
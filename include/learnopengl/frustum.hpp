@@ -0,0 +1,170 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE 1
+#endif
+
+// Axis aligned box in model space, filled while a mesh is loaded.
+struct Bounds
+{
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+    bool empty() const { return min.x > max.x; }
+
+    void add(glm::vec3 point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void add(const Bounds &other)
+    {
+        if (other.empty())
+            return;
+        add(other.min);
+        add(other.max);
+    }
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    float radius() const { return glm::length(max - min) * 0.5f; }
+
+    // bounding sphere of the box placed with matrix model, returned as
+    // (center, radius)
+    glm::vec4 sphere(const glm::mat4 &model) const
+    {
+        // nothing known about the extent, never cull it
+        if (empty())
+            return glm::vec4(glm::vec3(model[3]), std::numeric_limits<float>::max());
+        glm::vec3 worldCenter = glm::vec3(model * glm::vec4(center(), 1.0f));
+        return glm::vec4(worldCenter, radius() * maxScale(model));
+    }
+
+    // largest factor model scales a length by
+    static float maxScale(const glm::mat4 &model)
+    {
+        return glm::max(glm::length(glm::vec3(model[0])),
+                        glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    }
+};
+
+// The six planes of a view volume, pointing inwards, taken from a
+// projection * view matrix.
+class Frustum
+{
+public:
+    // (normal, distance): a point p is inside if dot(normal, p) + distance >= 0
+    glm::vec4 planes[6];
+
+    Frustum() {}
+
+    Frustum(const glm::mat4 &projectionView)
+    {
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++)
+            rows[i] = glm::vec4(projectionView[0][i], projectionView[1][i], projectionView[2][i], projectionView[3][i]);
+        for (int i = 0; i < 3; i++)
+        {
+            planes[2 * i] = rows[3] + rows[i];
+            planes[2 * i + 1] = rows[3] - rows[i];
+        }
+        for (glm::vec4 &plane : planes)
+            plane /= glm::length(glm::vec3(plane));
+    }
+
+    bool intersectsSphere(glm::vec4 sphere) const
+    {
+        for (const glm::vec4 &plane : planes)
+            if (glm::dot(glm::vec3(plane), glm::vec3(sphere)) + plane.w < -sphere.w)
+                return false;
+        return true;
+    }
+};
+
+// Bounding spheres of many objects stored as separate arrays, so that four of
+// them are tested against a frustum plane at once.
+class BoundingSpheres
+{
+public:
+    size_t size() const { return count; }
+
+    glm::vec4 operator[](size_t i) const { return glm::vec4(x[i], y[i], z[i], radius[i]); }
+
+    void clear()
+    {
+        count = 0;
+        x.clear();
+        y.clear();
+        z.clear();
+        radius.clear();
+    }
+
+    void add(glm::vec4 sphere)
+    {
+        // the arrays are kept padded to a multiple of four
+        if (count % 4 == 0)
+        {
+            x.resize(count + 4, 0.0f);
+            y.resize(count + 4, 0.0f);
+            z.resize(count + 4, 0.0f);
+            radius.resize(count + 4, 0.0f);
+        }
+        x[count] = sphere.x;
+        y[count] = sphere.y;
+        z[count] = sphere.z;
+        radius[count] = sphere.w;
+        count++;
+    }
+
+    // replaces visible with the indices of the spheres inside frustum
+    void cull(const Frustum &frustum, std::vector<uint32_t> &visible) const
+    {
+        visible.clear();
+#ifdef FRUSTUM_SSE
+        __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+        for (int p = 0; p < 6; p++)
+        {
+            planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+            planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+            planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+            planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+        }
+        for (size_t i = 0; i < count; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&x[i]);
+            __m128 cy = _mm_loadu_ps(&y[i]);
+            __m128 cz = _mm_loadu_ps(&z[i]);
+            __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius[i]));
+            __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+            for (int p = 0; p < 6; p++)
+            {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], cx), _mm_mul_ps(planeY[p], cy)),
+                                             _mm_add_ps(_mm_mul_ps(planeZ[p], cz), planeW[p]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+            }
+            int mask = _mm_movemask_ps(inside);
+            for (int lane = 0; lane < 4 && mask; lane++, mask >>= 1)
+                if ((mask & 1) && i + lane < count)
+                    visible.push_back(i + lane);
+        }
+#else
+        for (size_t i = 0; i < count; i++)
+            if (frustum.intersectsSphere(glm::vec4(x[i], y[i], z[i], radius[i])))
+                visible.push_back(i);
+#endif
+    }
+
+private:
+    size_t count = 0;
+    std::vector<float> x, y, z, radius;
+};
+
+#endif
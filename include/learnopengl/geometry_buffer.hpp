@@ -0,0 +1,164 @@
+#ifndef GEOMETRY_BUFFER_HPP
+#define GEOMETRY_BUFFER_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <functional>
+
+// One vertex buffer, one index buffer and one VAO that many meshes allocate
+// their static geometry from. Each mesh gets a range of vertices and indices
+// and is drawn with glDraw*BaseVertex, so drawing any number of meshes never
+// changes the VAO, and draws of different meshes can be merged into a single
+// glMultiDrawElementsIndirect call (see RenderQueue). Indices are either all
+// GL_UNSIGNED_SHORT or all GL_UNSIGNED_INT, as one multi-draw call needs.
+//
+// The buffers grow by doubling: the old contents are copied on the GPU and
+// the attribute pointers are set up again with setupAttributes, which
+// describes the vertex format for the buffer bound to GL_ARRAY_BUFFER.
+class GeometryBuffer
+{
+public:
+    unsigned int VAO = 0;
+    // instance buffer currently attached to attribute locations 5-8, the
+    // first instance they point at, and the generation the buffer was given
+    // with (see StreamBuffer::generation)
+    unsigned int instanceBuffer = 0;
+    unsigned int instanceOffset = 0;
+    unsigned int instanceGeneration = 0;
+
+    // where the data of one add() went
+    struct Range
+    {
+        int baseVertex;
+        unsigned int firstIndex;
+    };
+
+    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    const GLenum indexType;
+
+    GeometryBuffer(size_t vertexSize, GLenum indexType, std::function<void()> setupAttributes)
+        : indexType(indexType), vertexSize(vertexSize),
+          indexSize(indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int)),
+          setupAttributes(setupAttributes)
+    {
+        glGenVertexArrays(1, &VAO);
+    }
+
+    size_t vertexCount() const { return vertices; }
+    size_t indexCount() const { return indices; }
+
+    // appends vertexCount vertices of vertexSize bytes and indexCount indices
+    // of indexType (relative to the first of those vertices)
+    Range add(const void *vertexData, size_t vertexCount, const void *indexData, size_t indexCount)
+    {
+        reserve(vertices + vertexCount, indices + indexCount);
+        Range range;
+        range.baseVertex = (int)vertices;
+        range.firstIndex = (unsigned int)indices;
+
+        // the copy targets leave the element buffer binding of whatever VAO
+        // is bound alone
+        if (vertexCount)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, vertices * vertexSize, vertexCount * vertexSize, vertexData);
+        }
+        if (indexCount)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, indices * indexSize, indexCount * indexSize, indexData);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        vertices += vertexCount;
+        indices += indexCount;
+        return range;
+    }
+
+    // per-instance model matrices (one glm::mat4 per instance) at attribute
+    // locations 5-8, starting with matrix firstInstance; leaves the VAO
+    // unbound when it had to change anything. A buffer name reused after a
+    // delete is attached again when it comes with another generation.
+    void setInstanceBuffer(unsigned int buffer, unsigned int firstInstance = 0, unsigned int generation = 0)
+    {
+        if (buffer == instanceBuffer && firstInstance == instanceOffset && generation == instanceGeneration)
+            return;
+        instanceBuffer = buffer;
+        instanceOffset = firstInstance;
+        instanceGeneration = generation;
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        // a mat4 attribute takes four vec4 locations
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            glEnableVertexAttribArray(5 + i);
+            glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                                  (void *)(firstInstance * sizeof(glm::mat4) + i * sizeof(glm::vec4)));
+            glVertexAttribDivisor(5 + i, 1);
+        }
+        glBindVertexArray(0);
+    }
+
+private:
+    size_t vertexSize;
+    size_t indexSize;
+    std::function<void()> setupAttributes;
+    unsigned int VBO = 0, EBO = 0;
+    size_t vertices = 0, indices = 0;
+    size_t vertexCapacity = 0, indexCapacity = 0;
+
+    void reserve(size_t vertexCount, size_t indexCount)
+    {
+        if (vertexCount > vertexCapacity)
+        {
+            vertexCapacity = grown(vertexCapacity, vertexCount, 1 << 16);
+            VBO = reallocate(VBO, vertices * vertexSize, vertexCapacity * vertexSize);
+            glBindVertexArray(VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            setupAttributes();
+            glBindVertexArray(0);
+        }
+        if (indexCount > indexCapacity)
+        {
+            indexCapacity = grown(indexCapacity, indexCount, 1 << 18);
+            EBO = reallocate(EBO, indices * indexSize, indexCapacity * indexSize);
+            glBindVertexArray(VAO);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+            glBindVertexArray(0);
+        }
+    }
+
+    static size_t grown(size_t capacity, size_t needed, size_t minimum)
+    {
+        if (capacity < minimum)
+            capacity = minimum;
+        while (capacity < needed)
+            capacity *= 2;
+        return capacity;
+    }
+
+    // a new buffer of size bytes holding the first used bytes of buffer,
+    // which is deleted
+    static unsigned int reallocate(unsigned int buffer, size_t used, size_t size)
+    {
+        unsigned int resized;
+        glGenBuffers(1, &resized);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, resized);
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+        if (buffer)
+        {
+            if (used)
+            {
+                glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+                glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            }
+            glDeleteBuffers(1, &buffer);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return resized;
+    }
+};
+
+#endif
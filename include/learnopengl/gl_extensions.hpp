@@ -0,0 +1,102 @@
+#ifndef GL_EXTENSIONS_HPP
+#define GL_EXTENSIONS_HPP
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// GL features newer than the 3.3 core profile glad is generated for. The
+// context may still provide them (most desktop drivers hand out a 4.x context
+// when asked for 3.3 core); loadGLExtensions() resolves their entry points
+// after gladLoadGL, and code using them checks the flags and falls back to
+// plain 3.3 when a feature is missing.
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef void(APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+typedef void(APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void *indirect,
+                                                           GLsizei drawcount, GLsizei stride);
+
+// layout of one glMultiDrawElementsIndirect command
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+struct GLExtensions
+{
+    // glMultiDrawElementsIndirect with baseInstance honoured (GL 4.3, or
+    // ARB_multi_draw_indirect together with ARB_base_instance)
+    bool multiDrawIndirect = false;
+    PFNGLMULTIDRAWELEMENTSINDIRECTPROC MultiDrawElementsIndirect = nullptr;
+    // immutable buffer storage that can stay mapped while the GPU reads it
+    // (GL 4.4 or ARB_buffer_storage)
+    bool bufferStorage = false;
+    PFNGLBUFFERSTORAGEPROC BufferStorage = nullptr;
+    // gl_Layer writable from the vertex shader, so layered rendering needs
+    // no geometry shader
+    bool vertexShaderLayer = false;
+
+    static bool versionAtLeast(int major, int minor)
+    {
+        return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+    }
+
+    static bool hasExtension(const char *name)
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+            if (extension && std::strcmp(extension, name) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    void load(GLADloadproc loader)
+    {
+        if (versionAtLeast(4, 3) ||
+            (hasExtension("GL_ARB_multi_draw_indirect") &&
+             (versionAtLeast(4, 2) || hasExtension("GL_ARB_base_instance"))))
+        {
+            MultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)loader("glMultiDrawElementsIndirect");
+            if (!MultiDrawElementsIndirect)
+                MultiDrawElementsIndirect =
+                    (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)loader("glMultiDrawElementsIndirectARB");
+        }
+        multiDrawIndirect = MultiDrawElementsIndirect != nullptr;
+        if (versionAtLeast(4, 4) || hasExtension("GL_ARB_buffer_storage"))
+            BufferStorage = (PFNGLBUFFERSTORAGEPROC)loader("glBufferStorage");
+        bufferStorage = BufferStorage != nullptr;
+        vertexShaderLayer =
+            hasExtension("GL_ARB_shader_viewport_layer_array") || hasExtension("GL_AMD_vertex_shader_layer");
+    }
+};
+
+inline GLExtensions &glExtensions()
+{
+    static GLExtensions extensions;
+    return extensions;
+}
+
+// call once after gladLoadGL with the window system's loader, e.g.
+// (GLADloadproc)glfwGetProcAddress
+inline void loadGLExtensions(GLADloadproc loader)
+{
+    glExtensions().load(loader);
+}
+
+#endif
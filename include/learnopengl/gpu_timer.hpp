@@ -0,0 +1,71 @@
+#ifndef GPU_TIMER_HPP
+#define GPU_TIMER_HPP
+
+#include <glad/glad.h>
+
+// GPU time spent on the commands between begin() and end(), measured with
+// GL_TIME_ELAPSED queries. Reading a result right away would stall until the
+// GPU catches up, so the queries rotate through a ring and milliseconds holds
+// the newest result that is available, a few frames old. Timers must not
+// overlap each other, GL allows one time elapsed query at a time.
+class GpuTimer
+{
+public:
+    enum
+    {
+        LATENCY = 4
+    };
+
+    // last available measurement
+    float milliseconds = 0.0f;
+
+    void begin()
+    {
+        if (!queries[0])
+            glGenQueries(LATENCY, queries);
+        collect();
+        // still not done after LATENCY frames, give up on it
+        pending[current] = false;
+        glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+    }
+
+    void end()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        pending[current] = true;
+        issued[current] = ++sequence;
+        current = (current + 1) % LATENCY;
+    }
+
+private:
+    unsigned int queries[LATENCY] = {0};
+    bool pending[LATENCY] = {false};
+    // order the queries were issued in, so an older result never replaces a
+    // newer one
+    unsigned long issued[LATENCY] = {0};
+    unsigned long sequence = 0, newest = 0;
+    unsigned int current = 0;
+
+    void collect()
+    {
+        for (unsigned int i = 0; i < LATENCY; i++)
+        {
+            if (!pending[i])
+                continue;
+            GLint available = 0;
+            glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+            pending[i] = false;
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &nanoseconds);
+            if (issued[i] > newest)
+            {
+                newest = issued[i];
+                milliseconds = nanoseconds / 1.0e6f;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef HEADLESS_CONTEXT_HPP
+#define HEADLESS_CONTEXT_HPP
+
+#include <glad/glad.h>
+
+#include <dlfcn.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// An OpenGL 3.3 core context without a window or display, for benchmarks on
+// machines without either (CI with Mesa's llvmpipe). There is no default
+// framebuffer, everything has to be drawn into framebuffer objects.
+//
+// Tried in order:
+//  - EGL on the surfaceless platform (EGL_MESA_platform_surfaceless), or
+//    the default display, with a context made current without a surface
+//    (EGL_KHR_surfaceless_context)
+//  - OSMesa, which renders into a buffer in memory
+// Both libraries are opened at run time, so the build needs neither and a
+// machine with a display doesn't either. The handful of EGL and OSMesa
+// declarations needed are below.
+class HeadlessContext
+{
+public:
+    // "EGL" or "OSMesa" once created
+    const char *api = nullptr;
+
+    ~HeadlessContext() { destroy(); }
+
+    bool create(unsigned int width, unsigned int height)
+    {
+        return createEGL() || createOSMesa(width, height);
+    }
+
+    // for gladLoadGLLoader and loadGLExtensions
+    GLADloadproc loader() const { return &HeadlessContext::getProcAddress; }
+
+    void destroy()
+    {
+        if (eglDisplay)
+        {
+            egl().MakeCurrent(eglDisplay, nullptr, nullptr, nullptr);
+            if (eglContext)
+                egl().DestroyContext(eglDisplay, eglContext);
+            egl().Terminate(eglDisplay);
+            eglDisplay = eglContext = nullptr;
+        }
+        if (osmesaContext)
+        {
+            osmesa().DestroyContext(osmesaContext);
+            osmesaContext = nullptr;
+        }
+        api = nullptr;
+    }
+
+private:
+    typedef void *EGLDisplay;
+    typedef void *EGLConfig;
+    typedef void *EGLContext;
+    typedef void *EGLSurface;
+    typedef int32_t EGLint;
+    typedef unsigned int EGLBoolean;
+    typedef unsigned int EGLenum;
+    typedef void *OSMesaContext;
+
+    enum
+    {
+        EGL_NONE = 0x3038,
+        EGL_EXTENSIONS = 0x3055,
+        EGL_SURFACE_TYPE = 0x3033,
+        EGL_PBUFFER_BIT = 0x0001,
+        EGL_RENDERABLE_TYPE = 0x3040,
+        EGL_OPENGL_BIT = 0x0008,
+        EGL_OPENGL_API = 0x30A2,
+        EGL_CONTEXT_MAJOR_VERSION = 0x3098,
+        EGL_CONTEXT_MINOR_VERSION = 0x30FB,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK = 0x30FD,
+        EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT = 0x0001,
+        EGL_PLATFORM_SURFACELESS_MESA = 0x31DD,
+
+        OSMESA_FORMAT = 0x22,
+        OSMESA_RGBA = GL_RGBA,
+        OSMESA_DEPTH_BITS = 0x30,
+        OSMESA_STENCIL_BITS = 0x31,
+        OSMESA_PROFILE = 0x33,
+        OSMESA_CORE_PROFILE = 0x34,
+        OSMESA_CONTEXT_MAJOR_VERSION = 0x36,
+        OSMESA_CONTEXT_MINOR_VERSION = 0x37
+    };
+
+    struct EGL
+    {
+        void *library = nullptr;
+        void *(*GetProcAddress)(const char *name) = nullptr;
+        EGLDisplay (*GetDisplay)(void *nativeDisplay) = nullptr;
+        EGLBoolean (*Initialize)(EGLDisplay display, EGLint *major, EGLint *minor) = nullptr;
+        EGLBoolean (*Terminate)(EGLDisplay display) = nullptr;
+        const char *(*QueryString)(EGLDisplay display, EGLint name) = nullptr;
+        EGLBoolean (*BindAPI)(EGLenum api) = nullptr;
+        EGLBoolean (*ChooseConfig)(EGLDisplay display, const EGLint *attributes, EGLConfig *configs,
+                                   EGLint size, EGLint *count) = nullptr;
+        EGLContext (*CreateContext)(EGLDisplay display, EGLConfig config, EGLContext share,
+                                    const EGLint *attributes) = nullptr;
+        EGLBoolean (*DestroyContext)(EGLDisplay display, EGLContext context) = nullptr;
+        EGLBoolean (*MakeCurrent)(EGLDisplay display, EGLSurface draw, EGLSurface read,
+                                  EGLContext context) = nullptr;
+        // EGL_EXT_platform_base
+        EGLDisplay (*GetPlatformDisplayEXT)(EGLenum platform, void *nativeDisplay, const EGLint *attributes) = nullptr;
+    };
+
+    struct OSMesa
+    {
+        void *library = nullptr;
+        OSMesaContext (*CreateContextAttribs)(const int *attributes, OSMesaContext share) = nullptr;
+        GLboolean (*MakeCurrent)(OSMesaContext context, void *buffer, GLenum type, GLsizei width,
+                                 GLsizei height) = nullptr;
+        void (*DestroyContext)(OSMesaContext context) = nullptr;
+        void *(*GetProcAddress)(const char *name) = nullptr;
+    };
+
+    EGLDisplay eglDisplay = nullptr;
+    EGLContext eglContext = nullptr;
+    OSMesaContext osmesaContext = nullptr;
+    // OSMesa's color buffer; drawing goes to framebuffer objects anyway
+    std::vector<unsigned char> osmesaBuffer;
+
+    static EGL &egl()
+    {
+        static EGL functions;
+        return functions;
+    }
+
+    static OSMesa &osmesa()
+    {
+        static OSMesa functions;
+        return functions;
+    }
+
+    static void *open(const char *const *names)
+    {
+        for (; *names; names++)
+            if (void *library = dlopen(*names, RTLD_NOW | RTLD_LOCAL))
+                return library;
+        return nullptr;
+    }
+
+    template <typename Function> static bool symbol(void *library, const char *name, Function &function)
+    {
+        function = (Function)dlsym(library, name);
+        return function != nullptr;
+    }
+
+    static bool hasExtension(const char *extensions, const char *name)
+    {
+        if (!extensions)
+            return false;
+        size_t length = std::strlen(name);
+        for (const char *found = std::strstr(extensions, name); found; found = std::strstr(found + length, name))
+            if ((found == extensions || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0'))
+                return true;
+        return false;
+    }
+
+    bool createEGL()
+    {
+        EGL &f = egl();
+        const char *names[] = {"libEGL.so.1", "libEGL.so", nullptr};
+        if (!f.library && !(f.library = open(names)))
+            return false;
+        if (!symbol(f.library, "eglGetProcAddress", f.GetProcAddress) ||
+            !symbol(f.library, "eglGetDisplay", f.GetDisplay) || !symbol(f.library, "eglInitialize", f.Initialize) ||
+            !symbol(f.library, "eglTerminate", f.Terminate) || !symbol(f.library, "eglQueryString", f.QueryString) ||
+            !symbol(f.library, "eglBindAPI", f.BindAPI) || !symbol(f.library, "eglChooseConfig", f.ChooseConfig) ||
+            !symbol(f.library, "eglCreateContext", f.CreateContext) ||
+            !symbol(f.library, "eglDestroyContext", f.DestroyContext) ||
+            !symbol(f.library, "eglMakeCurrent", f.MakeCurrent))
+            return false;
+
+        // client extensions, queried without a display
+        const char *clientExtensions = f.QueryString(nullptr, EGL_EXTENSIONS);
+        f.GetPlatformDisplayEXT = (EGLDisplay(*)(EGLenum, void *, const EGLint *))f.GetProcAddress(
+            "eglGetPlatformDisplayEXT");
+        if (f.GetPlatformDisplayEXT && hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+            eglDisplay = f.GetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, nullptr, nullptr);
+        if (!eglDisplay)
+            eglDisplay = f.GetDisplay(nullptr);
+        EGLint major, minor;
+        if (!eglDisplay || !f.Initialize(eglDisplay, &major, &minor))
+        {
+            eglDisplay = nullptr;
+            return false;
+        }
+
+        if (!hasExtension(f.QueryString(eglDisplay, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context") ||
+            !f.BindAPI(EGL_OPENGL_API))
+        {
+            destroy();
+            return false;
+        }
+        const EGLint configAttributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                           EGL_NONE};
+        EGLConfig config = nullptr;
+        EGLint count = 0;
+        // without a matching config, EGL_KHR_no_config_context may still
+        // take none
+        if (!f.ChooseConfig(eglDisplay, configAttributes, &config, 1, &count) || count < 1)
+            config = nullptr;
+        const EGLint contextAttributes[] = {EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+                                            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                            EGL_NONE};
+        eglContext = f.CreateContext(eglDisplay, config, nullptr, contextAttributes);
+        if (!eglContext || !f.MakeCurrent(eglDisplay, nullptr, nullptr, eglContext))
+        {
+            destroy();
+            return false;
+        }
+        api = "EGL";
+        return true;
+    }
+
+    bool createOSMesa(unsigned int width, unsigned int height)
+    {
+        OSMesa &f = osmesa();
+        const char *names[] = {"libOSMesa.so.8", "libOSMesa.so.6", "libOSMesa.so", nullptr};
+        if (!f.library && !(f.library = open(names)))
+            return false;
+        if (!symbol(f.library, "OSMesaCreateContextAttribs", f.CreateContextAttribs) ||
+            !symbol(f.library, "OSMesaMakeCurrent", f.MakeCurrent) ||
+            !symbol(f.library, "OSMesaDestroyContext", f.DestroyContext) ||
+            !symbol(f.library, "OSMesaGetProcAddress", f.GetProcAddress))
+            return false;
+
+        const int attributes[] = {OSMESA_FORMAT, OSMESA_RGBA, OSMESA_DEPTH_BITS, 24, OSMESA_STENCIL_BITS, 8,
+                                  OSMESA_PROFILE, OSMESA_CORE_PROFILE, OSMESA_CONTEXT_MAJOR_VERSION, 3,
+                                  OSMESA_CONTEXT_MINOR_VERSION, 3, 0};
+        osmesaContext = f.CreateContextAttribs(attributes, nullptr);
+        if (!osmesaContext)
+            return false;
+        osmesaBuffer.resize((size_t)width * height * 4);
+        if (!f.MakeCurrent(osmesaContext, osmesaBuffer.data(), GL_UNSIGNED_BYTE, width, height))
+        {
+            destroy();
+            return false;
+        }
+        api = "OSMesa";
+        return true;
+    }
+
+    static void *getProcAddress(const char *name)
+    {
+        if (osmesa().GetProcAddress && osmesa().library)
+        {
+            if (void *function = osmesa().GetProcAddress(name))
+                return function;
+        }
+        return egl().GetProcAddress ? egl().GetProcAddress(name) : nullptr;
+    }
+};
+
+#endif
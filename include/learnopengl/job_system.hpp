@@ -0,0 +1,271 @@
+#ifndef JOB_SYSTEM_HPP
+#define JOB_SYSTEM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Tracks a set of jobs. wait() on a group returns once every job run in it,
+// including jobs added while waiting, has finished. A group can also be the
+// dependency of jobs in other groups, which start only after it completes.
+class TaskGroup
+{
+public:
+    bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+    std::atomic<int> pending{0};
+    std::mutex continuationMutex;
+    // jobs waiting for this group, with the group they belong to
+    std::vector<std::pair<TaskGroup *, std::function<void()>>> continuations;
+};
+
+// Work-stealing thread pool shared by everything that wants to run in
+// parallel. Every worker, and the main thread, owns a deque: jobs spawned on a
+// thread go to the back of its own deque and are taken from the back (most
+// recent, still in cache), idle threads steal from the front of others'.
+// The main thread executes jobs only while it waits on a group.
+//
+// Jobs must not touch OpenGL, GL work is queued with runOnMainThread() and
+// executed where the main loop calls processMainThreadJobs().
+class JobSystem
+{
+public:
+    JobSystem(unsigned int workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1)
+    {
+        // queue 0 belongs to the thread that created the job system
+        queues.resize(workerCount + 1);
+        for (auto &queue : queues)
+            queue.reset(new Queue());
+        threadIndex() = 0;
+        for (unsigned int i = 1; i <= workerCount; i++)
+            workers.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            running = false;
+        }
+        sleepCondition.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    unsigned int threadCount() const { return queues.size(); }
+
+    void run(TaskGroup &group, std::function<void()> job)
+    {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        push(new Task{std::move(job), &group});
+    }
+
+    // runs job in group once every job of dependency has finished
+    void run(TaskGroup &group, std::function<void()> job, TaskGroup &dependency)
+    {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(dependency.continuationMutex);
+            if (!dependency.done())
+            {
+                dependency.continuations.emplace_back(&group, std::move(job));
+                return;
+            }
+        }
+        push(new Task{std::move(job), &group});
+    }
+
+    // executes other jobs until group is done
+    void wait(TaskGroup &group)
+    {
+        while (!group.done())
+        {
+            Task *task = take();
+            if (task)
+                execute(task);
+            else
+                std::this_thread::yield();
+        }
+        // the thread that finished the last job may still be releasing the
+        // group's continuations; the group must outlive that
+        std::lock_guard<std::mutex> lock(group.continuationMutex);
+    }
+
+    // calls f(first, last) on consecutive chunks of [begin, end) of at most
+    // grain elements, in parallel, and returns when all are done
+    template <typename F>
+    void parallelFor(size_t begin, size_t end, size_t grain, F f)
+    {
+        if (end <= begin)
+            return;
+        grain = std::max<size_t>(grain, 1);
+        if (end - begin <= grain)
+        {
+            f(begin, end);
+            return;
+        }
+        TaskGroup group;
+        for (size_t first = begin + grain; first < end; first += grain)
+        {
+            size_t last = std::min(first + grain, end);
+            run(group, [&f, first, last] { f(first, last); });
+        }
+        // the calling thread does the first chunk itself
+        f(begin, std::min(begin + grain, end));
+        wait(group);
+    }
+
+    // queues GL (or other main thread only) work from any thread
+    void runOnMainThread(std::function<void()> job)
+    {
+        std::lock_guard<std::mutex> lock(mainThreadMutex);
+        mainThreadJobs.push_back(std::move(job));
+    }
+
+    void processMainThreadJobs()
+    {
+        std::vector<std::function<void()>> jobs;
+        {
+            std::lock_guard<std::mutex> lock(mainThreadMutex);
+            jobs.swap(mainThreadJobs);
+        }
+        for (auto &job : jobs)
+            job();
+    }
+
+private:
+    struct Task
+    {
+        std::function<void()> job;
+        TaskGroup *group;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task *> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<int> queued{0};
+    std::atomic<int> sleeping{0};
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    bool running = true;
+
+    std::mutex mainThreadMutex;
+    std::vector<std::function<void()>> mainThreadJobs;
+
+    static unsigned int &threadIndex()
+    {
+        thread_local unsigned int index = 0;
+        return index;
+    }
+
+    void push(Task *task)
+    {
+        Queue &queue = *queues[threadIndex()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(task);
+        }
+        // seq_cst pairs with the worker counting itself as sleeping before it
+        // checks queued: one of the two sees the other's increment
+        queued.fetch_add(1);
+        // waking a worker is a syscall, skip it when all of them are busy
+        if (sleeping.load() > 0)
+        {
+            // a worker between its check and its wait holds sleepMutex, taking
+            // it here keeps the notify from falling into that gap
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+            }
+            sleepCondition.notify_one();
+        }
+    }
+
+    Task *take()
+    {
+        if (queued.load(std::memory_order_acquire) <= 0)
+            return nullptr;
+
+        unsigned int self = threadIndex();
+        {
+            Queue &own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                Task *task = own.tasks.back();
+                own.tasks.pop_back();
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+        for (unsigned int i = 1; i < queues.size(); i++)
+        {
+            Queue &victim = *queues[(self + i) % queues.size()];
+            std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+            if (lock.owns_lock() && !victim.tasks.empty())
+            {
+                Task *task = victim.tasks.front();
+                victim.tasks.pop_front();
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    void execute(Task *task)
+    {
+        task->job();
+        TaskGroup &group = *task->group;
+        delete task;
+
+        // decrement under the lock so that run() with this group as dependency
+        // either sees it unfinished and queues a continuation that is released
+        // here, or sees it done and runs the job right away
+        std::vector<std::pair<TaskGroup *, std::function<void()>>> continuations;
+        {
+            std::lock_guard<std::mutex> lock(group.continuationMutex);
+            if (group.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                continuations.swap(group.continuations);
+        }
+        // the group may already be gone, only the moved out list is used
+        for (auto &continuation : continuations)
+            push(new Task{std::move(continuation.second), continuation.first});
+    }
+
+    void workerLoop(unsigned int index)
+    {
+        threadIndex() = index;
+        while (true)
+        {
+            Task *task = take();
+            if (task)
+            {
+                execute(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            if (!running)
+                return;
+            sleeping.fetch_add(1);
+            // push() notifies whenever it sees a sleeper, no timeout needed
+            sleepCondition.wait(lock, [this] { return !running || queued.load() > 0; });
+            sleeping.fetch_sub(1);
+        }
+    }
+};
+
+#endif
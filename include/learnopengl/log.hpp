@@ -0,0 +1,253 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Asynchronous logger for code that runs every frame.
+//
+// LOG_INFO("Marker %d reached", idx) formats the message into a ring buffer
+// owned by the calling thread and returns; a background thread drains all
+// buffers to stdout. Producers never lock, never flush and never wait: if a
+// buffer is full the message is dropped and counted. Messages below LOG_LEVEL
+// are removed at compile time, and the *_RATE variants additionally limit
+// how often a single call site may log.
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_NONE 5
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if defined(__GNUC__)
+#define LOG_PRINTF_FORMAT(formatIndex, firstArg) __attribute__((format(printf, formatIndex, firstArg)))
+#else
+#define LOG_PRINTF_FORMAT(formatIndex, firstArg)
+#endif
+
+// Per call site limit of maxPerSecond messages; the number of suppressed
+// messages is reported with the next one that gets through.
+class LogRateLimit
+{
+public:
+    bool allow(uint32_t maxPerSecond, uint32_t &suppressedBefore)
+    {
+        int64_t second = std::chrono::duration_cast<std::chrono::seconds>(
+                             std::chrono::steady_clock::now().time_since_epoch())
+                             .count();
+        int64_t current = window.load(std::memory_order_relaxed);
+        if (current != second && window.compare_exchange_strong(current, second))
+            count.store(0, std::memory_order_relaxed);
+        if (count.fetch_add(1, std::memory_order_relaxed) < maxPerSecond)
+        {
+            suppressedBefore = suppressed.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+private:
+    std::atomic<int64_t> window{0};
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> suppressed{0};
+};
+
+class Logger
+{
+public:
+    static const size_t MESSAGE_SIZE = 256;
+    // per thread, must be a power of two
+    static const size_t RING_SIZE = 1024;
+
+    static Logger &instance()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    void write(int level, const char *format, ...) LOG_PRINTF_FORMAT(3, 4)
+    {
+        Ring &ring = threadRing();
+        size_t head = ring.head.load(std::memory_order_relaxed);
+        if (head - ring.tail.load(std::memory_order_acquire) == RING_SIZE)
+        {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        Message &message = ring.messages[head & (RING_SIZE - 1)];
+        message.time = std::chrono::steady_clock::now();
+        message.level = level;
+        va_list args;
+        va_start(args, format);
+        vsnprintf(message.text, MESSAGE_SIZE, format, args);
+        va_end(args);
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+    // blocks until everything logged so far has been written
+    void flush()
+    {
+        while (!drain())
+            std::this_thread::yield();
+        fflush(output);
+    }
+
+    ~Logger()
+    {
+        running.store(false);
+        writer.join();
+        drain();
+        fflush(output);
+    }
+
+private:
+    struct Message
+    {
+        std::chrono::steady_clock::time_point time;
+        int level;
+        char text[MESSAGE_SIZE];
+    };
+
+    // single producer (the owning thread), single consumer (the writer)
+    struct Ring
+    {
+        std::atomic<size_t> head{0};
+        std::atomic<size_t> tail{0};
+        std::atomic<uint32_t> dropped{0};
+        Message messages[RING_SIZE];
+    };
+
+    FILE *output = stdout;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // rings are never freed before the logger, a thread may exit with
+    // messages still queued
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::mutex ringsMutex;
+    std::atomic<bool> running{true};
+    std::thread writer;
+
+    Logger() : writer([this] { run(); })
+    {
+    }
+
+    Ring &threadRing()
+    {
+        thread_local Ring *ring = nullptr;
+        if (!ring)
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            rings.emplace_back(new Ring());
+            ring = rings.back().get();
+        }
+        return *ring;
+    }
+
+    void run()
+    {
+        while (running.load())
+        {
+            if (drain())
+            {
+                fflush(output);
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        }
+    }
+
+    // writes out queued messages, returns true when all rings were empty
+    bool drain()
+    {
+        static const char *levelNames[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR"};
+        bool empty = true;
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for (auto &ring : rings)
+        {
+            size_t tail = ring->tail.load(std::memory_order_relaxed);
+            size_t head = ring->head.load(std::memory_order_acquire);
+            for (; tail != head; tail++)
+            {
+                const Message &message = ring->messages[tail & (RING_SIZE - 1)];
+                double seconds = std::chrono::duration<double>(message.time - start).count();
+                fprintf(output, "[%10.4f] %-5s %s\n", seconds, levelNames[message.level], message.text);
+                empty = false;
+            }
+            ring->tail.store(tail, std::memory_order_release);
+
+            uint32_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped)
+                fprintf(output, "%u log messages dropped, buffer full\n", dropped);
+        }
+        return empty;
+    }
+};
+
+#define LOG_WRITE(level, ...) Logger::instance().write(level, __VA_ARGS__)
+
+#define LOG_WRITE_RATE(level, maxPerSecond, ...)                                  \
+    do                                                                            \
+    {                                                                             \
+        static LogRateLimit logRateLimit;                                         \
+        uint32_t logSuppressed;                                                   \
+        if (logRateLimit.allow(maxPerSecond, logSuppressed))                      \
+        {                                                                         \
+            if (logSuppressed)                                                    \
+                LOG_WRITE(level, "(%u similar messages suppressed)", logSuppressed); \
+            LOG_WRITE(level, __VA_ARGS__);                                        \
+        }                                                                         \
+    } while (0)
+
+#if LOG_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) LOG_WRITE(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_TRACE_RATE(n, ...) LOG_WRITE_RATE(LOG_LEVEL_TRACE, n, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void)0)
+#define LOG_TRACE_RATE(n, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_WRITE(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_DEBUG_RATE(n, ...) LOG_WRITE_RATE(LOG_LEVEL_DEBUG, n, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#define LOG_DEBUG_RATE(n, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_WRITE(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_INFO_RATE(n, ...) LOG_WRITE_RATE(LOG_LEVEL_INFO, n, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#define LOG_INFO_RATE(n, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_WRITE(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_WARN_RATE(n, ...) LOG_WRITE_RATE(LOG_LEVEL_WARN, n, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#define LOG_WARN_RATE(n, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_WRITE(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_ERROR_RATE(n, ...) LOG_WRITE_RATE(LOG_LEVEL_ERROR, n, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#define LOG_ERROR_RATE(n, ...) ((void)0)
+#endif
+
+#endif
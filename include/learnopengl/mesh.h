@@ -7,66 +7,68 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <learnopengl/shader.h>
+#include <learnopengl/frustum.hpp>
+#include <learnopengl/geometry_buffer.hpp>
+#include <learnopengl/vertex_format.hpp>
+#include <learnopengl/mesh_simplify.hpp>
 
+#include <memory>
 #include <string>
 #include <vector>
 using namespace std;
 
-struct Vertex {
-    // position
-    glm::vec3 Position;
-    // normal
-    glm::vec3 Normal;
-    // texCoords
-    glm::vec2 TexCoords;
-    // tangent
-    glm::vec3 Tangent;
-    // bitangent
-    glm::vec3 Bitangent;
-};
-
-
-
 struct Texture {
     unsigned int id;
     string type;
     string path;
+    // layer of id when it is a GL_TEXTURE_2D_ARRAY, see TextureArrays
+    int layer = -1;
 };
 
-class Mesh {
-public:
-    // mesh Data
-    vector<Vertex>       vertices;
-    vector<unsigned int> indices;
-    vector<Texture>      textures;
+// The textures of a mesh, resolved once when the mesh is loaded: texture i is
+// bound to unit i and sampled through the uniform samplerNames[i]
+// (e.g. "texture_diffuse1"). The sampler uniforms are looked up once for every
+// program the material is drawn with, after that binding the material does no
+// string work at all.
+//
+// Textures packed into texture arrays (see TextureArrays) are bound as
+// GL_TEXTURE_2D_ARRAY, and the layer of texture i goes to the float uniform
+// samplerNames[i] + "Layer" (e.g. "texture_diffuse1Layer").
+struct Material {
+    enum { MAX_TEXTURES = 8 };
 
-    unsigned int VAO;
-    std::string glslIdentifierPrefix;
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
-    {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+    // sampler uniforms of one program, samplers[i] reads unit i
+    struct ProgramBinding {
+        unsigned int program;
+        Shader::Uniform samplers[MAX_TEXTURES];
+        Shader::Uniform layerUniforms[MAX_TEXTURES];
+    };
 
-        // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
-    }
+    unsigned int textureCount = 0;
+    unsigned int textures[MAX_TEXTURES];
+    // GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY when every texture is an array
+    GLenum textureTarget = GL_TEXTURE_2D;
+    // the diffuse texture has an alpha channel, which the model shaders may
+    // discard fragments by; see RenderQueue's depth prepass
+    bool alphaTested = false;
+    int layers[MAX_TEXTURES];
+    vector<string> samplerNames;
+    vector<ProgramBinding> programs;
 
-    // render the mesh
-    void Draw(Shader &shader)
+    Material() {}
+
+    Material(const vector<Texture> &meshTextures, const string &prefix)
     {
-        // bind appropriate textures
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr   = 1;
         unsigned int heightNr   = 1;
-        for(unsigned int i = 0; i < textures.size(); i++)
+        textureCount = meshTextures.size() < (size_t)MAX_TEXTURES ? meshTextures.size() : (size_t)MAX_TEXTURES;
+        for(unsigned int i = 0; i < textureCount; i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
-            string name = textures[i].type;
+            string name = meshTextures[i].type;
             if(name == "texture_diffuse")
                 number = std::to_string(diffuseNr++);
             else if(name == "texture_specular")
@@ -76,64 +78,194 @@ public:
             else if(name == "texture_height")
                 number = std::to_string(heightNr++); // transfer unsigned int to stream
 
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            textures[i] = meshTextures[i].id;
+            layers[i] = meshTextures[i].layer;
+            if (layers[i] >= 0)
+                textureTarget = GL_TEXTURE_2D_ARRAY;
+            samplerNames.push_back(prefix + name + number);
+        }
+        for (unsigned int i = 0; i < textureCount; i++)
+        {
+            if (meshTextures[i].type == "texture_diffuse")
+            {
+                alphaTested = hasAlpha(textureTarget, textures[i]);
+                break;
+            }
+        }
+    }
+
+    // texture i is now layer of the array texture; lookups done by resolve()
+    // before are dropped, they miss the layer uniforms
+    void useTextureArray(unsigned int i, unsigned int texture, int layer)
+    {
+        textures[i] = texture;
+        layers[i] = layer;
+        textureTarget = GL_TEXTURE_2D_ARRAY;
+        programs.clear();
+    }
+
+    static bool hasAlpha(GLenum target, unsigned int texture)
+    {
+        int alphaSize = 0;
+        glBindTexture(target, texture);
+        glGetTexLevelParameteriv(target, 0, GL_TEXTURE_ALPHA_SIZE, &alphaSize);
+        glBindTexture(target, 0);
+        return alphaSize > 0;
+    }
+
+    // looks the sampler uniforms up in shader unless that was done before;
+    // call it at load time for the programs the material will be used with
+    const ProgramBinding &resolve(Shader &shader)
+    {
+        for (const ProgramBinding &binding : programs)
+            if (binding.program == shader.ID)
+                return binding;
+        ProgramBinding binding;
+        binding.program = shader.ID;
+        for (unsigned int i = 0; i < textureCount; i++)
+        {
+            binding.samplers[i] = shader.uniform(samplerNames[i]);
+            if (textureTarget == GL_TEXTURE_2D_ARRAY)
+                binding.layerUniforms[i] = shader.uniform(samplerNames[i] + "Layer");
+        }
+        programs.push_back(binding);
+        return programs.back();
+    }
+
+    // points the sampler uniforms of shader, which has to be in use, to the
+    // texture units
+    void setSamplers(Shader &shader)
+    {
+        const ProgramBinding &binding = resolve(shader);
+        for (unsigned int i = 0; i < textureCount; i++)
+            shader.setInt(binding.samplers[i], i);
+        if (textureTarget == GL_TEXTURE_2D_ARRAY)
+            for (unsigned int i = 0; i < textureCount; i++)
+                shader.setFloat(binding.layerUniforms[i], layers[i]);
+    }
+
+    void bind(Shader &shader)
+    {
+        setSamplers(shader);
+        for (unsigned int i = 0; i < textureCount; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
+            glBindTexture(textureTarget, textures[i]);
         }
+    }
+};
+
+class Mesh {
+public:
+    // mesh Data
+    vector<Vertex>       vertices;
+    // all levels of detail, one after the other
+    vector<unsigned int> indices;
+    // lods[0] is the full mesh
+    vector<MeshLod>      lods;
+    vector<Texture>      textures;
+    Material             material;
+    // model space box around the vertices
+    Bounds               bounds;
+    // VertexAttributes stored on the GPU
+    unsigned int         attributes;
+    // indices are uploaded as 16 bit when the vertices allow it
+    GLenum               indexType;
+
+    // the VAO of geometry(), and where the mesh's vertices and
+    // indices start in its buffers; MeshLod::indexOffset counts from firstIndex
+    unsigned int VAO;
+    int baseVertex = 0;
+    unsigned int firstIndex = 0;
+    // constructor
+    // availableAttributes tells which VertexAttributes the vertices really
+    // carry, the rest is not uploaded
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures,
+         vector<MeshLod> lods = vector<MeshLod>(),
+         unsigned int availableAttributes = VERTEX_TEXCOORDS | VERTEX_TANGENT)
+    {
+        this->vertices = vertices;
+        this->indices = indices;
+        this->textures = textures;
+        if (lods.empty())
+            lods.push_back(MeshLod{0, (unsigned int)indices.size(), 0.0f});
+        this->lods = lods;
+        this->material = Material(textures, "");
+        this->attributes = VertexFormat::choose(vertices, availableAttributes);
+        this->indexType = vertices.size() <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
 
+        // now that we have all the required data, set the vertex buffers and its attribute pointers.
+        setupMesh();
+    }
 
+    // render the mesh
+    void Draw(Shader &shader)
+    {
+        material.bind(shader);
 
         // draw mesh
         glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+        glDrawElementsBaseVertex(GL_TRIANGLES, lods[0].indexCount, indexType, indexPointer(0), baseVertex);
         glBindVertexArray(0);
 
         // always good practice to set everything back to defaults once configured.
         glActiveTexture(GL_TEXTURE0);
     }
 
-private:
-    // render data
-    unsigned int VBO, EBO;
+    // per-instance model matrices (one glm::mat4 per instance) at attribute locations 5-8,
+    // starting with matrix firstInstance. The attributes belong to the shared VAO,
+    // so this affects every mesh with the same vertex format.
+    void setInstanceBuffer(unsigned int buffer, unsigned int firstInstance = 0, unsigned int generation = 0)
+    {
+        geometry().setInstanceBuffer(buffer, firstInstance, generation);
+    }
 
-    // initializes all the buffer objects/arrays
-    void setupMesh()
+    // offset in the element buffer of index i of the mesh, for glDraw* calls
+    const void *indexPointer(unsigned int i) const
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+        return (const void*)((firstIndex + i) * indexSize);
+    }
 
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+    // vertex and index storage shared by all meshes with this mesh's
+    // attributes and index type
+    GeometryBuffer &geometry() const
+    {
+        return geometry(attributes, indexType);
+    }
 
-        glBindVertexArray(0);
+    // one buffer per vertex format and index type, created on first use
+    static GeometryBuffer &geometry(unsigned int attributes, GLenum indexType)
+    {
+        static std::unique_ptr<GeometryBuffer> buffers[VERTEX_ATTRIBUTE_COMBINATIONS][2];
+        std::unique_ptr<GeometryBuffer> &buffer = buffers[attributes][indexType == GL_UNSIGNED_SHORT];
+        if (!buffer)
+        {
+            VertexFormat format(attributes);
+            buffer.reset(new GeometryBuffer(format.stride, indexType, [format]() { format.setupAttributes(); }));
+        }
+        return *buffer;
+    }
+
+private:
+    // packs the vertices and places them in the shared geometry buffer
+    void setupMesh()
+    {
+        GeometryBuffer &buffer = geometry();
+        vector<unsigned char> packed = VertexFormat(attributes).pack(vertices);
+        GeometryBuffer::Range range;
+        if (indexType == GL_UNSIGNED_SHORT)
+        {
+            vector<unsigned short> shortIndices(indices.begin(), indices.end());
+            range = buffer.add(packed.data(), vertices.size(), shortIndices.data(), shortIndices.size());
+        }
+        else
+        {
+            range = buffer.add(packed.data(), vertices.size(), indices.data(), indices.size());
+        }
+        VAO = buffer.VAO;
+        baseVertex = range.baseVertex;
+        firstIndex = range.firstIndex;
     }
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,308 @@
+#ifndef MESH_OPTIMIZE_HPP
+#define MESH_OPTIMIZE_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Import time reordering of indexed triangle meshes for the GPU:
+//
+//  - weldVertices merges vertices with identical bytes; importers emit one
+//    vertex per face corner, so without it nothing is shared and every
+//    triangle costs three vertex shader runs
+//  - optimizeVertexCache orders triangles so that their vertices are still in
+//    the post-transform cache (Tipsify, Sander et al. 2007)
+//  - optimizeOverdraw then moves whole clusters of that order so that
+//    outward facing parts of the mesh are drawn first, where the reordering
+//    doesn't cost cache misses
+//  - optimizeVertexFetch renumbers the vertices in the order the triangles
+//    first use them, so vertex fetches walk through memory linearly
+//
+// The quality measure is the ACMR, average cache misses (vertex shader runs)
+// per triangle: 3 without any reuse, 0.5 at best for large regular grids.
+
+// FIFO post-transform cache the reordering assumes; small enough for every
+// GPU in use, larger real caches only do better
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+// average cache misses per triangle of indices with a FIFO cache
+inline float averageCacheMissRatio(const unsigned int *indices, size_t indexCount, size_t vertexCount,
+                                   unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+    if (indexCount < 3)
+        return 0.0f;
+    // a vertex is cached while fewer than cacheSize misses happened since its own
+    std::vector<size_t> missedAt(vertexCount, 0);
+    size_t misses = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        unsigned int vertex = indices[i];
+        if (missedAt[vertex] == 0 || misses - missedAt[vertex] + 1 > cacheSize)
+            missedAt[vertex] = ++misses;
+    }
+    return (float)misses / (indexCount / 3);
+}
+
+// merges vertices whose bytes are identical, keeping the first of each and
+// rewriting indices; V must not contain padding
+template <typename V>
+void weldVertices(std::vector<V> &vertices, std::vector<unsigned int> &indices)
+{
+    size_t tableSize = 1;
+    while (tableSize < vertices.size() * 2)
+        tableSize *= 2;
+    // open addressing hash table of indices into welded, ~0u is empty
+    std::vector<unsigned int> table(tableSize, ~0u);
+    std::vector<unsigned int> remap(vertices.size());
+    std::vector<V> welded;
+    welded.reserve(vertices.size());
+
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        // FNV-1a over the bytes
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&vertices[i]);
+        uint32_t hash = 2166136261u;
+        for (size_t b = 0; b < sizeof(V); b++)
+            hash = (hash ^ bytes[b]) * 16777619u;
+
+        size_t slot = hash & (tableSize - 1);
+        while (table[slot] != ~0u && std::memcmp(&welded[table[slot]], &vertices[i], sizeof(V)) != 0)
+            slot = (slot + 1) & (tableSize - 1);
+        if (table[slot] == ~0u)
+        {
+            table[slot] = welded.size();
+            welded.push_back(vertices[i]);
+        }
+        remap[i] = table[slot];
+    }
+
+    for (unsigned int &index : indices)
+        index = remap[index];
+    vertices.swap(welded);
+}
+
+// triangle order of indices[0..indexCount) with good post-transform cache
+// use, in place; runs in linear time
+inline void optimizeVertexCache(unsigned int *indices, size_t indexCount, size_t vertexCount,
+                                unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+        return;
+
+    // triangles using each vertex
+    std::vector<unsigned int> adjacencyStart(vertexCount + 1, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        adjacencyStart[indices[i] + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+        adjacencyStart[v + 1] += adjacencyStart[v];
+    std::vector<unsigned int> adjacency(triangleCount * 3);
+    std::vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    // triangles not emitted yet, per vertex
+    std::vector<unsigned int> live(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        live[v] = adjacencyStart[v + 1] - adjacencyStart[v];
+    std::vector<size_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<unsigned int> deadEnd, candidates;
+    std::vector<unsigned int> result;
+    result.reserve(triangleCount * 3);
+
+    size_t time = cacheSize + 1;
+    size_t cursor = 0;
+    long fanning = 0;
+    while (fanning >= 0)
+    {
+        candidates.clear();
+        for (unsigned int a = adjacencyStart[fanning]; a < adjacencyStart[fanning + 1]; a++)
+        {
+            unsigned int triangle = adjacency[a];
+            if (emitted[triangle])
+                continue;
+            emitted[triangle] = true;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int vertex = indices[triangle * 3 + k];
+                result.push_back(vertex);
+                deadEnd.push_back(vertex);
+                candidates.push_back(vertex);
+                live[vertex]--;
+                if (time - cacheTime[vertex] > cacheSize)
+                    cacheTime[vertex] = time++;
+            }
+        }
+
+        // the candidate that will still be cached after its remaining
+        // triangles are emitted, and has been in the cache longest
+        fanning = -1;
+        size_t best = 0;
+        for (unsigned int vertex : candidates)
+        {
+            if (!live[vertex])
+                continue;
+            size_t age = time - cacheTime[vertex];
+            if (age + 2 * live[vertex] <= cacheSize && age > best)
+            {
+                best = age;
+                fanning = vertex;
+            }
+        }
+        if (fanning >= 0)
+            continue;
+
+        // dead end: a recently used vertex with triangles left, else the
+        // next one in input order
+        while (!deadEnd.empty() && fanning < 0)
+        {
+            unsigned int vertex = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[vertex])
+                fanning = vertex;
+        }
+        while (fanning < 0 && cursor < vertexCount)
+        {
+            if (live[cursor])
+                fanning = cursor;
+            cursor++;
+        }
+    }
+
+    std::copy(result.begin(), result.end(), indices);
+}
+
+// reorders clusters of the (cache optimized) triangle order so that clusters
+// facing away from the mesh center come first and hide what is behind them.
+// A cluster starts at every triangle whose vertices all miss the cache, so
+// moving clusters around keeps the ACMR. positions has stride bytes between
+// consecutive vertices.
+inline void optimizeOverdraw(unsigned int *indices, size_t indexCount, const glm::vec3 *positions,
+                             size_t vertexCount, size_t stride, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+        return;
+    auto position = [&](unsigned int vertex) -> const glm::vec3 & {
+        return *reinterpret_cast<const glm::vec3 *>(reinterpret_cast<const char *>(positions) + vertex * stride);
+    };
+
+    std::vector<size_t> clusterStart;
+    std::vector<size_t> missedAt(vertexCount, 0);
+    size_t misses = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        int triangleMisses = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int vertex = indices[t * 3 + k];
+            if (missedAt[vertex] == 0 || misses - missedAt[vertex] + 1 > cacheSize)
+            {
+                missedAt[vertex] = ++misses;
+                triangleMisses++;
+            }
+        }
+        if (triangleMisses == 3)
+            clusterStart.push_back(t);
+    }
+    if (clusterStart.empty() || clusterStart[0] != 0)
+        clusterStart.insert(clusterStart.begin(), 0);
+    clusterStart.push_back(triangleCount);
+    size_t clusterCount = clusterStart.size() - 1;
+    if (clusterCount < 2)
+        return;
+
+    // area weighted centroid and normal of every cluster and the mesh
+    std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0.0f)), normals(clusterCount, glm::vec3(0.0f));
+    std::vector<float> areas(clusterCount, 0.0f);
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+        {
+            glm::vec3 a = position(indices[t * 3]), b = position(indices[t * 3 + 1]), d = position(indices[t * 3 + 2]);
+            glm::vec3 normal = glm::cross(b - a, d - a);
+            float area = glm::length(normal);
+            centroids[c] += (a + b + d) * (area / 3.0f);
+            normals[c] += normal;
+            areas[c] += area;
+        }
+        meshCentroid += centroids[c];
+        meshArea += areas[c];
+        if (areas[c] > 0.0f)
+            centroids[c] /= areas[c];
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    std::vector<float> sortKey(clusterCount);
+    std::vector<unsigned int> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        float length = glm::length(normals[c]);
+        glm::vec3 normal = length > 0.0f ? normals[c] / length : glm::vec3(0.0f);
+        sortKey[c] = glm::dot(normal, centroids[c] - meshCentroid);
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](unsigned int a, unsigned int b) { return sortKey[a] > sortKey[b]; });
+
+    std::vector<unsigned int> result;
+    result.reserve(triangleCount * 3);
+    for (unsigned int c : order)
+        result.insert(result.end(), indices + clusterStart[c] * 3, indices + clusterStart[c + 1] * 3);
+    std::copy(result.begin(), result.end(), indices);
+}
+
+// renumbers vertices in order of first use by indices and drops the unused
+// ones
+template <typename V>
+void optimizeVertexFetch(std::vector<V> &vertices, std::vector<unsigned int> &indices)
+{
+    std::vector<unsigned int> remap(vertices.size(), ~0u);
+    std::vector<V> ordered;
+    ordered.reserve(vertices.size());
+    for (unsigned int &index : indices)
+    {
+        if (remap[index] == ~0u)
+        {
+            remap[index] = ordered.size();
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+}
+
+// what optimizeMesh did
+struct MeshOptimizeStats
+{
+    size_t verticesBefore = 0, verticesAfter = 0;
+    float acmrBefore = 0.0f, acmrAfter = 0.0f;
+};
+
+// all of the above for a mesh of V, which has a glm::vec3 Position
+template <typename V>
+MeshOptimizeStats optimizeMesh(std::vector<V> &vertices, std::vector<unsigned int> &indices)
+{
+    MeshOptimizeStats stats;
+    stats.verticesBefore = vertices.size();
+    stats.acmrBefore = averageCacheMissRatio(indices.data(), indices.size(), vertices.size());
+    if (!vertices.empty() && !indices.empty())
+    {
+        weldVertices(vertices, indices);
+        optimizeVertexCache(indices.data(), indices.size(), vertices.size());
+        optimizeOverdraw(indices.data(), indices.size(), &vertices[0].Position, vertices.size(), sizeof(V));
+        optimizeVertexFetch(vertices, indices);
+    }
+    stats.verticesAfter = vertices.size();
+    stats.acmrAfter = averageCacheMissRatio(indices.data(), indices.size(), vertices.size());
+    return stats;
+}
+
+#endif
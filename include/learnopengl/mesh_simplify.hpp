@@ -0,0 +1,359 @@
+#ifndef MESH_SIMPLIFY_HPP
+#define MESH_SIMPLIFY_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// One level of detail of a mesh: a range of its index buffer. Level 0 is the
+// original, the others are simplified versions reusing the same vertices.
+struct MeshLod
+{
+    unsigned int indexOffset;
+    unsigned int indexCount;
+    // largest distance (in model units) the simplified surface may be away
+    // from the original one
+    float error;
+};
+
+// Quadric error metric simplification (Garland & Heckbert) restricted to
+// collapsing a vertex onto one of its neighbours, so the simplified triangles
+// index the original vertex buffer and all levels can share it.
+//
+// Vertices sharing a position (attribute seams, flat shading) move together:
+// every one of them is remapped to a vertex at the target position that it
+// shares a triangle with, so the attributes along a seam get stretched a bit,
+// which is fine for levels drawn at a distance. Vertices on open borders
+// stay where they are to keep the outline.
+class MeshSimplifier
+{
+public:
+    // positions: vertexCount positions, stride bytes apart
+    MeshSimplifier(const void *positions, size_t vertexCount, size_t stride)
+        : vertexCount(vertexCount)
+    {
+        this->positions.resize(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++)
+            std::memcpy(&this->positions[i], (const char *)positions + i * stride, sizeof(glm::vec3));
+        weld();
+    }
+
+    // simplifies the triangle list indices down to about targetIndexCount
+    // indices, or less if a collapse would move the surface more than
+    // maxError; error receives the largest error accepted
+    std::vector<unsigned int> simplify(const std::vector<unsigned int> &indices, size_t targetIndexCount,
+                                       float maxError, float *error = nullptr)
+    {
+        std::vector<unsigned int> result = indices;
+        findLockedVertices(result);
+        computeQuadrics(result);
+
+        double maxCost = (double)maxError * maxError;
+        double acceptedCost = 0.0;
+        std::vector<unsigned int> remap(vertexCount);
+        std::vector<bool> touched(vertexCount);
+        std::vector<Collapse> collapses;
+
+        while (result.size() > targetIndexCount)
+        {
+            buildAdjacency(result);
+            collectCollapses(result, collapses);
+            std::sort(collapses.begin(), collapses.end(),
+                      [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+            for (unsigned int v = 0; v < vertexCount; v++)
+                remap[v] = v;
+            std::fill(touched.begin(), touched.end(), false);
+
+            // every pass collapses the cheapest edges whose surroundings were
+            // not changed in the same pass, until enough triangles are gone
+            size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+            size_t removed = 0;
+            for (const Collapse &collapse : collapses)
+            {
+                if (removed >= trianglesToRemove || collapse.cost > maxCost)
+                    break;
+                unsigned int from = collapse.from, to = collapse.to;
+                if (touched[from] || touched[weldRoot[to]] || flips(result, from, to))
+                    continue;
+
+                for (unsigned int i = rootStart[from]; i < rootStart[from + 1]; i++)
+                {
+                    unsigned int vertex = rootVertices[i];
+                    remap[vertex] = collapseTarget(result, vertex, to);
+                    for (unsigned int t = adjacencyStart[vertex]; t < adjacencyStart[vertex + 1]; t++)
+                        for (int k = 0; k < 3; k++)
+                            touched[weldRoot[result[adjacency[t] * 3 + k]]] = true;
+                }
+                quadrics[weldRoot[to]].add(quadrics[from]);
+                acceptedCost = std::max(acceptedCost, collapse.cost);
+                // an interior edge collapse removes two triangles
+                removed += 2;
+            }
+
+            size_t before = result.size();
+            applyRemap(result, remap);
+            if (result.size() == before)
+                break;
+        }
+
+        if (error)
+            *error = (float)std::sqrt(acceptedCost);
+        return result;
+    }
+
+private:
+    struct Quadric
+    {
+        // upper triangle of the symmetric 4x4 matrix
+        double a00 = 0, a01 = 0, a02 = 0, a03 = 0, a11 = 0, a12 = 0, a13 = 0, a22 = 0, a23 = 0, a33 = 0;
+
+        void addPlane(glm::dvec4 p)
+        {
+            a00 += p.x * p.x; a01 += p.x * p.y; a02 += p.x * p.z; a03 += p.x * p.w;
+            a11 += p.y * p.y; a12 += p.y * p.z; a13 += p.y * p.w;
+            a22 += p.z * p.z; a23 += p.z * p.w;
+            a33 += p.w * p.w;
+        }
+
+        void add(const Quadric &q)
+        {
+            a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+            a11 += q.a11; a12 += q.a12; a13 += q.a13;
+            a22 += q.a22; a23 += q.a23;
+            a33 += q.a33;
+        }
+
+        // sum of squared distances of v to the planes
+        double error(glm::vec3 v) const
+        {
+            double x = v.x, y = v.y, z = v.z;
+            return a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+                 + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+                 + a22 * z * z + 2 * a23 * z
+                 + a33;
+        }
+    };
+
+    struct Collapse
+    {
+        unsigned int from, to;
+        double cost;
+    };
+
+    size_t vertexCount;
+    std::vector<glm::vec3> positions;
+    // first vertex with the same position
+    std::vector<unsigned int> weldRoot;
+    // all vertices of weld root r are rootVertices[rootStart[r]..rootStart[r + 1])
+    std::vector<unsigned int> rootStart, rootVertices;
+    // per weld root, positions on open borders
+    std::vector<bool> locked;
+    // per weld root
+    std::vector<Quadric> quadrics;
+    // triangles around every vertex
+    std::vector<unsigned int> adjacencyStart, adjacency;
+
+    void weld()
+    {
+        struct PositionHash
+        {
+            size_t operator()(const glm::vec3 &p) const
+            {
+                uint32_t bits[3];
+                std::memcpy(bits, &p, sizeof(bits));
+                return bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u;
+            }
+        };
+        std::unordered_map<glm::vec3, unsigned int, PositionHash> first;
+        weldRoot.resize(vertexCount);
+        rootStart.assign(vertexCount + 1, 0);
+        for (unsigned int v = 0; v < vertexCount; v++)
+        {
+            weldRoot[v] = first.emplace(positions[v], v).first->second;
+            rootStart[weldRoot[v] + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++)
+            rootStart[v + 1] += rootStart[v];
+        rootVertices.resize(vertexCount);
+        std::vector<unsigned int> fill(rootStart.begin(), rootStart.end() - 1);
+        for (unsigned int v = 0; v < vertexCount; v++)
+            rootVertices[fill[weldRoot[v]]++] = v;
+    }
+
+    void findLockedVertices(const std::vector<unsigned int> &indices)
+    {
+        locked.assign(vertexCount, false);
+        // edges between positions used by a single triangle are open borders
+        std::unordered_map<uint64_t, int> edgeUse;
+        for (size_t i = 0; i < indices.size(); i += 3)
+            for (int k = 0; k < 3; k++)
+                edgeUse[edgeKey(indices[i + k], indices[i + (k + 1) % 3])]++;
+        for (const auto &edge : edgeUse)
+        {
+            if (edge.second != 1)
+                continue;
+            locked[edge.first >> 32] = true;
+            locked[edge.first & 0xffffffff] = true;
+        }
+    }
+
+    uint64_t edgeKey(unsigned int a, unsigned int b) const
+    {
+        uint64_t ra = weldRoot[a], rb = weldRoot[b];
+        return ra < rb ? ra << 32 | rb : rb << 32 | ra;
+    }
+
+    void computeQuadrics(const std::vector<unsigned int> &indices)
+    {
+        quadrics.assign(vertexCount, Quadric());
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            glm::vec3 p0 = positions[indices[i]], p1 = positions[indices[i + 1]], p2 = positions[indices[i + 2]];
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float length = glm::length(normal);
+            if (length == 0.0f)
+                continue;
+            normal /= length;
+            glm::dvec4 plane(normal.x, normal.y, normal.z, -glm::dot(normal, p0));
+            for (int k = 0; k < 3; k++)
+                quadrics[weldRoot[indices[i + k]]].addPlane(plane);
+        }
+    }
+
+    void buildAdjacency(const std::vector<unsigned int> &indices)
+    {
+        adjacencyStart.assign(vertexCount + 1, 0);
+        for (unsigned int index : indices)
+            adjacencyStart[index + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            adjacencyStart[v + 1] += adjacencyStart[v];
+        adjacency.resize(indices.size());
+        std::vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    void collectCollapses(const std::vector<unsigned int> &indices, std::vector<Collapse> &collapses) const
+    {
+        collapses.clear();
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int from = weldRoot[indices[i + k]], to = indices[i + (k + 1) % 3];
+                // each interior edge is seen from both of its triangles, in
+                // opposite directions, so both ways get considered
+                if (locked[from])
+                    continue;
+                Quadric q = quadrics[from];
+                q.add(quadrics[weldRoot[to]]);
+                collapses.push_back(Collapse{from, to, q.error(positions[to])});
+            }
+        }
+    }
+
+    // would moving position from onto to turn any remaining triangle over?
+    bool flips(const std::vector<unsigned int> &indices, unsigned int from, unsigned int to) const
+    {
+        glm::vec3 source = positions[from], target = positions[to];
+        for (unsigned int i = rootStart[from]; i < rootStart[from + 1]; i++)
+        {
+            unsigned int vertex = rootVertices[i];
+            for (unsigned int t = adjacencyStart[vertex]; t < adjacencyStart[vertex + 1]; t++)
+            {
+                const unsigned int *triangle = &indices[adjacency[t] * 3];
+                int corner = triangle[0] == vertex ? 0 : triangle[1] == vertex ? 1 : 2;
+                unsigned int b = triangle[(corner + 1) % 3], c = triangle[(corner + 2) % 3];
+                // triangles on the collapsed edge disappear
+                if (weldRoot[b] == weldRoot[to] || weldRoot[c] == weldRoot[to])
+                    continue;
+                glm::vec3 pb = positions[b], pc = positions[c];
+                glm::vec3 before = glm::cross(pb - source, pc - source);
+                glm::vec3 after = glm::cross(pb - target, pc - target);
+                if (glm::dot(before, after) <= 0.0f)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    // the vertex at the position of to that vertex should become: one it
+    // shares a triangle with if there is one, so it keeps matching attributes
+    unsigned int collapseTarget(const std::vector<unsigned int> &indices, unsigned int vertex, unsigned int to) const
+    {
+        for (unsigned int t = adjacencyStart[vertex]; t < adjacencyStart[vertex + 1]; t++)
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int other = indices[adjacency[t] * 3 + k];
+                if (weldRoot[other] == weldRoot[to])
+                    return other;
+            }
+        return to;
+    }
+
+    void applyRemap(std::vector<unsigned int> &indices, const std::vector<unsigned int> &remap) const
+    {
+        size_t write = 0;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            unsigned int a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (weldRoot[a] == weldRoot[b] || weldRoot[b] == weldRoot[c] || weldRoot[a] == weldRoot[c])
+                continue;
+            indices[write++] = a;
+            indices[write++] = b;
+            indices[write++] = c;
+        }
+        indices.resize(write);
+    }
+};
+
+// Appends simplified versions of the triangle list in indices to it, each with
+// about half the triangles of the previous one, and returns the ranges of all
+// levels including the original. Stops after maxLevels simplified levels, when
+// a level barely shrinks or when it would deviate from the original by more
+// than maxRelativeError times the size of the mesh.
+inline std::vector<MeshLod> buildMeshLods(const void *positions, size_t vertexCount, size_t stride,
+                                          std::vector<unsigned int> &indices, int maxLevels = 3,
+                                          float maxRelativeError = 0.05f)
+{
+    std::vector<MeshLod> lods;
+    unsigned int originalCount = indices.size();
+    lods.push_back(MeshLod{0, originalCount, 0.0f});
+    if (vertexCount == 0 || originalCount == 0)
+        return lods;
+
+    glm::vec3 low(0.0f), high(0.0f);
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        glm::vec3 p;
+        std::memcpy(&p, (const char *)positions + i * stride, sizeof(p));
+        low = i ? glm::min(low, p) : p;
+        high = i ? glm::max(high, p) : p;
+    }
+    float maxError = glm::length(high - low) * maxRelativeError;
+
+    MeshSimplifier simplifier(positions, vertexCount, stride);
+    std::vector<unsigned int> original(indices.begin(), indices.end());
+    unsigned int previousCount = originalCount;
+    for (int level = 1; level <= maxLevels; level++)
+    {
+        size_t target = (previousCount / 2) / 3 * 3;
+        float error = 0.0f;
+        std::vector<unsigned int> simplified = simplifier.simplify(original, target, maxError, &error);
+        // not worth a level of its own
+        if (simplified.empty() || simplified.size() > previousCount * 3 / 4)
+            break;
+        lods.push_back(MeshLod{(unsigned int)indices.size(), (unsigned int)simplified.size(), error});
+        indices.insert(indices.end(), simplified.begin(), simplified.end());
+        previousCount = simplified.size();
+    }
+    return lods;
+}
+
+#endif
@@ -11,8 +11,11 @@
 #include <assimp/postprocess.h>
 
 #include <learnopengl/mesh.h>
+#include <learnopengl/mesh_optimize.hpp>
+#include <learnopengl/log.hpp>
 #include <learnopengl/shader.h>
 
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -31,6 +34,11 @@ public:
     // model data
     vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh>    meshes;
+    // model space box around all meshes
+    Bounds          bounds;
+    // error of every level of detail relative to the model's radius; level i
+    // draws level min(i, last) of every mesh
+    vector<float>   lodErrors;
     string directory;
     bool gammaCorrection;
 
@@ -49,9 +57,16 @@ public:
 
     void SetShaderTextureNamePrefix(std::string prefix) {
         for (Mesh& mesh: meshes) {
-            mesh.glslIdentifierPrefix = prefix;
+            mesh.material = Material(mesh.textures, prefix);
         }
     }
+
+    // resolves the sampler uniforms of all materials for shader up front
+    void prepareMaterials(Shader &shader)
+    {
+        for (Mesh& mesh: meshes)
+            mesh.material.resolve(shader);
+    }
 private:
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const &path)
@@ -70,6 +85,20 @@ private:
 
         // process ASSIMP's root node recursively
         processNode(scene->mRootNode, scene);
+
+        for (const Mesh& mesh: meshes)
+            bounds.add(mesh.bounds);
+        for (const Mesh& mesh: meshes)
+            if (mesh.lods.size() > lodErrors.size())
+                lodErrors.resize(mesh.lods.size(), 0.0f);
+        for (const Mesh& mesh: meshes)
+        {
+            for (size_t level = 0; level < lodErrors.size(); level++)
+            {
+                float error = mesh.lods[std::min(level, mesh.lods.size() - 1)].error;
+                lodErrors[level] = std::max(lodErrors[level], error / std::max(bounds.radius(), 1e-6f));
+            }
+        }
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -97,17 +126,20 @@ private:
         vector<Vertex> vertices;
         vector<unsigned int> indices;
         vector<Texture> textures;
+        Bounds bounds;
 
         // walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            Vertex vertex;
+            // zeroed, so attributes the mesh lacks compare equal when welding
+            Vertex vertex = Vertex();
             glm::vec3 vector; // we declare a placeholder vector since assimp_ uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
             // positions
             vector.x = mesh->mVertices[i].x;
             vector.y = mesh->mVertices[i].y;
             vector.z = mesh->mVertices[i].z;
             vertex.Position = vector;
+            bounds.add(vector);
             // normals
             if (mesh->HasNormals())
             {
@@ -136,8 +168,6 @@ private:
                 vector.z = mesh->mBitangents[i].z;
                 vertex.Bitangent = vector;
             }
-            else
-                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
 
             vertices.push_back(vertex);
 
@@ -178,8 +208,44 @@ private:
 
 
 
+        // only upload what the mesh provides; tangents only matter with a
+        // normal or height map to apply them to
+        unsigned int availableAttributes = 0;
+        if (mesh->mTextureCoords[0])
+        {
+            availableAttributes |= VERTEX_TEXCOORDS;
+            if (mesh->HasTangentsAndBitangents() && (!normalMaps.empty() || !heightMaps.empty()))
+                availableAttributes |= VERTEX_TANGENT;
+        }
+
+        // attributes that won't be uploaded must not keep vertices apart
+        unsigned int attributes = VertexFormat::choose(vertices, availableAttributes);
+        for (Vertex &vertex : vertices)
+        {
+            if (!(attributes & VERTEX_TEXCOORDS))
+                vertex.TexCoords = glm::vec2(0.0f);
+            if (!(attributes & VERTEX_TANGENT))
+                vertex.Tangent = vertex.Bitangent = glm::vec3(0.0f);
+        }
+
+        // the importer gives every face corner its own vertex; weld them and
+        // order the triangles and vertices for the GPU caches
+        MeshOptimizeStats optimized = optimizeMesh(vertices, indices);
+        LOG_INFO("Mesh \"%s\": %zu triangles, %zu -> %zu vertices, ACMR %.3f -> %.3f", mesh->mName.C_Str(),
+                 indices.size() / 3, optimized.verticesBefore, optimized.verticesAfter, optimized.acmrBefore,
+                 optimized.acmrAfter);
+
+        // simplified versions for drawing at a distance, stored after the
+        // full index list
+        vector<MeshLod> lods = buildMeshLods(vertices.empty() ? nullptr : &vertices[0].Position,
+                                             vertices.size(), sizeof(Vertex), indices);
+        for (size_t level = 1; level < lods.size(); level++)
+            optimizeVertexCache(&indices[lods[level].indexOffset], lods[level].indexCount, vertices.size());
+
         // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        Mesh result(vertices, indices, textures, lods, availableAttributes);
+        result.bounds = bounds;
+        return result;
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -0,0 +1,184 @@
+#ifndef MODEL_INSTANCES_HPP
+#define MODEL_INSTANCES_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "frustum.hpp"
+#include "model.h"
+#include "render_queue.hpp"
+#include "shader.h"
+#include "stream_buffer.hpp"
+
+// Many copies of one model drawn with one instanced draw call per mesh and
+// level of detail. Every frame the instances are culled against the view
+// frustum (with the model's bounding sphere placed by each instance matrix),
+// the visible ones pick their level of detail and are grouped by it. Their
+// matrices live in a GPU buffer that is only re-uploaded when the instances,
+// the visible set or their levels change, so static sets (like the map
+// markers) cost nothing per frame besides culling and the draw calls while
+// the camera rests. Sets that change every frame (like the agents) are
+// better off with a stream: then the visible matrices are written into it
+// on every submit, without stalling on draws of earlier frames or queues
+// still reading them. Several instance sets may share a model. The
+// shader has to read the matrix from attribute location 5 instead of a
+// "model" uniform, see instancedModelShader.vs.
+class ModelInstances
+{
+public:
+    Model &model;
+    // instances in the set / drawn in the last submit()
+    unsigned int count = 0;
+    unsigned int visibleCount = 0;
+    // where the matrices go if set, instead of a buffer of this set's own
+    StreamBuffer *stream = nullptr;
+
+    ModelInstances(Model &model) : model(model)
+    {
+        glGenBuffers(1, &instanceVBO);
+    }
+
+    void update(const std::vector<glm::mat4> &matrices)
+    {
+        ids.clear();
+        lods.resize(matrices.size(), 0);
+        setMatrices(matrices);
+    }
+
+    // for sets rebuilt with other members every frame (like the agents near
+    // the view): ids[i] names what instance i stands for, and the level of
+    // detail stays with the id instead of the slot
+    void update(const std::vector<glm::mat4> &matrices, const std::vector<uint32_t> &ids)
+    {
+        this->ids = ids;
+        uint32_t maxId = 0;
+        for (uint32_t id : ids)
+            maxId = std::max(maxId, id);
+        if (!ids.empty() && maxId >= lods.size())
+            lods.resize(maxId + 1, 0);
+        setMatrices(matrices);
+    }
+
+    void submit(RenderQueue &queue, Shader &shader)
+    {
+        if (queue.culling)
+        {
+            spheres.cull(queue.frustum, visible);
+        }
+        else
+        {
+            visible.resize(count);
+            for (unsigned int i = 0; i < count; i++)
+                visible[i] = i;
+        }
+        sortByLod(queue);
+        unsigned int buffer = instanceVBO, first = 0, generation = 0;
+        if (stream)
+        {
+            // valid for this frame only, nothing to reuse next time
+            StreamBuffer::Allocation allocation = stream->allocate(sorted.size() * sizeof(glm::mat4),
+                                                                   sizeof(glm::mat4));
+            glm::mat4 *out = (glm::mat4 *)allocation.data;
+            for (size_t i = 0; i < sorted.size(); i++)
+                out[i] = matrices[sorted[i]];
+            stream->commit();
+            buffer = stream->buffer;
+            generation = stream->generation;
+            first = allocation.offset / sizeof(glm::mat4);
+        }
+        else if (dirty || sorted != uploaded)
+        {
+            upload();
+        }
+        visibleCount = visible.size();
+        queue.countCulled(visibleCount, count - visibleCount);
+        for (size_t level = 0; level + 1 < lodStart.size(); level++)
+            queue.submitInstanced(shader, model, buffer, lodStart[level + 1] - lodStart[level],
+                                  RenderQueue::PASS_OPAQUE, 0, level, first + lodStart[level], generation);
+    }
+
+    // all instances, visible or not
+    const std::vector<glm::mat4> &instanceMatrices() const { return matrices; }
+
+private:
+    unsigned int instanceVBO;
+    unsigned int capacity = 0;
+    std::vector<glm::mat4> matrices;
+    BoundingSpheres spheres;
+    // what every instance stands for, empty when that is its index
+    std::vector<uint32_t> ids;
+    // level of detail of every instance, or of every id
+    std::vector<unsigned char> lods;
+    // indices of the visible instances, the same grouped by level of detail
+    // and the order of the ones in the buffer
+    std::vector<uint32_t> visible, sorted, uploaded;
+    // instances of level l are sorted[lodStart[l]..lodStart[l + 1])
+    std::vector<uint32_t> lodStart;
+    // next free slot of every level while sorting
+    std::vector<uint32_t> fill;
+    std::vector<glm::mat4> visibleMatrices;
+    bool dirty = false;
+
+    void setMatrices(const std::vector<glm::mat4> &matrices)
+    {
+        count = matrices.size();
+        this->matrices = matrices;
+        spheres.clear();
+        for (const glm::mat4 &matrix : matrices)
+            spheres.add(model.bounds.sphere(matrix));
+        dirty = true;
+    }
+
+    void sortByLod(const RenderQueue &queue)
+    {
+        size_t levels = std::max<size_t>(model.lodErrors.size(), 1);
+        lodStart.assign(levels + 1, 0);
+        if (!queue.lod)
+        {
+            // all in full detail
+            sorted = visible;
+            lodStart[1] = visible.size();
+            for (size_t level = 1; level < levels; level++)
+                lodStart[level + 1] = lodStart[level];
+            return;
+        }
+        for (uint32_t i : visible)
+        {
+            unsigned char &lod = lods[ids.empty() ? i : ids[i]];
+            lod = queue.selectLod(model, spheres[i], lod);
+            lodStart[lod + 1]++;
+        }
+        for (size_t level = 0; level < levels; level++)
+            lodStart[level + 1] += lodStart[level];
+        sorted.resize(visible.size());
+        fill.assign(lodStart.begin(), lodStart.end() - 1);
+        for (uint32_t i : visible)
+            sorted[fill[lods[ids.empty() ? i : ids[i]]]++] = i;
+    }
+
+    void upload()
+    {
+        visibleMatrices.resize(sorted.size());
+        for (size_t i = 0; i < sorted.size(); i++)
+            visibleMatrices[i] = matrices[sorted[i]];
+        uploaded = sorted;
+        dirty = false;
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        if (visibleMatrices.size() > capacity)
+        {
+            capacity = visibleMatrices.size();
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(glm::mat4), visibleMatrices.data(), GL_DYNAMIC_DRAW);
+        }
+        else if (!visibleMatrices.empty())
+        {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, visibleMatrices.size() * sizeof(glm::mat4), visibleMatrices.data());
+        }
+    }
+};
+
+#endif
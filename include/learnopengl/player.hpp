@@ -4,8 +4,10 @@
 #include <glm/glm.hpp>
 #include <iostream>
 
+#include "log.hpp"
 #include "marker.hpp"
 #include "model.h"
+#include "render_queue.hpp"
 #include "shader.h"
 
 class Player
@@ -18,6 +20,8 @@ public:
     const float yoffset = 0.2f;
     Model markerModel{"resources/objects/marker/marker.obj"};
     Model playerModel{"resources/objects/viking/viking.obj"};
+    // levels of detail of the two models last frame, see RenderQueue::submit
+    unsigned int playerLod = 0, markerLod = 0;
     glm::vec3 scale;
     glm::vec3 position;
     bool isMoving = false;
@@ -31,33 +35,41 @@ public:
         playerMarker = Marker(0, position);
     }
 
-    void draw(Shader &shader)
+    void submit(RenderQueue &queue, Shader &shader)
+    {
+        queue.submit(shader, playerModel, playerMatrix(), RenderQueue::PASS_OPAQUE, 0, &playerLod);
+        queue.submit(shader, markerModel, markerMatrix(), RenderQueue::PASS_OPAQUE, 0, &markerLod);
+    }
+
+    glm::mat4 playerMatrix() const
     {
         glm::mat4 model = glm::mat4(1.0f);
         glm::vec3 translate{position.x, yoffset, position.z};
         model = glm::translate(model, translate);
         model = glm::scale(model, scale);
-        shader.setMat4("model", model);
-        playerModel.Draw(shader);
+        return model;
+    }
 
-        model = glm::mat4(1.0f);
+    // the marker under the player
+    glm::mat4 markerMatrix() const
+    {
+        glm::mat4 model = glm::mat4(1.0f);
 
-        translate = glm::vec3{position.x, 0.2f, position.z};
+        glm::vec3 translate = glm::vec3{position.x, 0.2f, position.z};
         model = glm::translate(model, translate);
 
         glm::vec3 markerScale = scale;
         markerScale *= markerScaleRatio;
         model = glm::scale(model, markerScale);
         model = glm::rotate(model, (float)glm::radians(180.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        shader.setMat4("model", model);
-        markerModel.Draw(shader);
+        return model;
     }
 
     void setRandomMovementTarget()
     {
         if (!currentMarker->neighbours.size())
         {
-            std::cout << "Marker has no neighbours" << std::endl;
+            LOG_WARN_RATE(1, "Marker %d has no neighbours", currentMarker->idx);
         }
         else if (isMoving)
         {
@@ -91,7 +103,7 @@ public:
 
         if (distanceBetweenPoints(targetMarker->position, position) < 0.1f)
         {
-            std::cout << "Movement done" << std::endl;
+            LOG_INFO("Movement done, reached marker %d", targetMarker->idx);
             currentMarker = targetMarker;
             targetMarker = nullptr;
             position = currentMarker->position;
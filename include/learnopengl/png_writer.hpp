@@ -0,0 +1,116 @@
+#ifndef PNG_WRITER_HPP
+#define PNG_WRITER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Writes 8-bit RGBA pixels as a PNG file, for frame dumps. The image data is
+// stored without compression (deflate "stored" blocks), which keeps this to a
+// CRC and an Adler checksum instead of a zlib dependency; dumps are few and
+// any image tool reads them. Rows are given bottom to top, as glReadPixels
+// returns them.
+class PngWriter
+{
+public:
+    static bool write(const char *path, unsigned int width, unsigned int height, const unsigned char *rgba)
+    {
+        // every row starts with filter type 0 (none)
+        size_t rowSize = (size_t)width * 4;
+        std::vector<unsigned char> raw;
+        raw.reserve((rowSize + 1) * height);
+        for (unsigned int y = 0; y < height; y++)
+        {
+            const unsigned char *row = rgba + (size_t)(height - 1 - y) * rowSize;
+            raw.push_back(0);
+            raw.insert(raw.end(), row, row + rowSize);
+        }
+
+        // zlib stream: header, stored blocks of at most 65535 bytes, Adler-32
+        std::vector<unsigned char> data = {0x78, 0x01};
+        size_t position = 0;
+        do
+        {
+            size_t length = std::min<size_t>(raw.size() - position, 65535);
+            bool last = position + length == raw.size();
+            data.push_back(last ? 1 : 0);
+            data.push_back(length & 0xff);
+            data.push_back(length >> 8);
+            data.push_back(~length & 0xff);
+            data.push_back((~length >> 8) & 0xff);
+            data.insert(data.end(), raw.begin() + position, raw.begin() + position + length);
+            position += length;
+        } while (position < raw.size());
+        appendBigEndian(data, adler32(raw));
+
+        std::vector<unsigned char> header;
+        appendBigEndian(header, width);
+        appendBigEndian(header, height);
+        // 8 bits per channel, RGBA, deflate, default filters, no interlace
+        const unsigned char format[] = {8, 6, 0, 0, 0};
+        header.insert(header.end(), format, format + sizeof(format));
+
+        FILE *file = std::fopen(path, "wb");
+        if (!file)
+            return false;
+        const unsigned char signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        bool ok = std::fwrite(signature, 1, sizeof(signature), file) == sizeof(signature);
+        ok = ok && writeChunk(file, "IHDR", header);
+        ok = ok && writeChunk(file, "IDAT", data);
+        ok = ok && writeChunk(file, "IEND", std::vector<unsigned char>());
+        return std::fclose(file) == 0 && ok;
+    }
+
+private:
+    static void appendBigEndian(std::vector<unsigned char> &out, uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back((value >> shift) & 0xff);
+    }
+
+    static uint32_t adler32(const std::vector<unsigned char> &bytes)
+    {
+        uint32_t a = 1, b = 0;
+        for (unsigned char byte : bytes)
+        {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        return b << 16 | a;
+    }
+
+    static uint32_t crc32(uint32_t crc, const unsigned char *bytes, size_t count)
+    {
+        static uint32_t table[256];
+        static bool tableReady = false;
+        if (!tableReady)
+        {
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                table[n] = c;
+            }
+            tableReady = true;
+        }
+        crc = ~crc;
+        for (size_t i = 0; i < count; i++)
+            crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    static bool writeChunk(FILE *file, const char *type, const std::vector<unsigned char> &data)
+    {
+        std::vector<unsigned char> chunk;
+        appendBigEndian(chunk, data.size());
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        // the CRC covers the type and the data
+        appendBigEndian(chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+        return std::fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+    }
+};
+
+#endif
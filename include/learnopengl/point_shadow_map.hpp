@@ -0,0 +1,305 @@
+#ifndef POINT_SHADOW_MAP_HPP
+#define POINT_SHADOW_MAP_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "gl_extensions.hpp"
+#include "gpu_timer.hpp"
+#include "model.h"
+#include "shader.h"
+#include "stream_buffer.hpp"
+
+// Omnidirectional shadows of a point light: a depth cube map holding the
+// distance from the light to the nearest caster, divided by farPlane.
+//
+// All six faces are drawn in one pass. Every caster is tested against the
+// view volume of each face on the CPU and gets one instance per face it
+// touches, so a caster next to the light costs one or two faces instead of
+// six. The face goes into the unused [0][3] element of the instance matrix
+// (always 0 for affine transforms), and the shader writes it to gl_Layer of
+// the layered framebuffer: straight from the vertex shader where
+// GLExtensions::vertexShaderLayer allows it (pointShadowLayerShader.vs),
+// else through a pass through geometry shader (pointShadowShader.vs/.gs).
+// Either way one instanced draw call per mesh covers all casters of a model.
+//
+// The face size follows how large shadows near the light appear on screen,
+// as a power of two between minSize and budget.
+class PointShadowMap
+{
+public:
+    enum
+    {
+        FACE_COUNT = 6
+    };
+
+    // distances beyond this from the light are never in shadow
+    float farPlane = 25.0f;
+    float nearPlane = 0.05f;
+    // largest and smallest face size in texels
+    unsigned int budget = 1024;
+    unsigned int minSize = 128;
+
+    // current face size and the depth cube map
+    unsigned int size = 0;
+    unsigned int depthCubemap = 0;
+
+    struct Stats
+    {
+        unsigned int casters = 0;
+        // caster faces drawn, and skipped by the per-face test
+        unsigned int faces = 0;
+        unsigned int facesCulled = 0;
+        unsigned int drawCalls = 0;
+    };
+    Stats stats;
+    GpuTimer timer;
+    // where the instance matrices go if set, instead of a buffer of the
+    // map's own re-specified every frame
+    StreamBuffer *stream = nullptr;
+
+    PointShadowMap()
+    {
+        glGenFramebuffers(1, &FBO);
+        glGenBuffers(1, &instanceVBO);
+        resize(budget);
+    }
+
+    // starts collecting the casters of a frame
+    void begin(glm::vec3 lightPosition)
+    {
+        this->lightPosition = lightPosition;
+        stats = Stats();
+        for (Group &group : groups)
+            group.matrices.clear();
+    }
+
+    void add(Model &model, const glm::mat4 &matrix)
+    {
+        addInstance(groupOf(model), matrix);
+    }
+
+    void add(Model &model, const std::vector<glm::mat4> &matrices)
+    {
+        Group &group = groupOf(model);
+        for (const glm::mat4 &matrix : matrices)
+            addInstance(group, matrix);
+    }
+
+    // picks the face size: shadows receivers at receiverDistance from the
+    // light get about one texel per pixel for a camera cameraDistance away
+    // that covers pixelsPerUnit pixels per world unit at distance one
+    void chooseSize(float receiverDistance, float cameraDistance, float pixelsPerUnit)
+    {
+        // a face spans 90 degrees, 2 * r wide at distance r
+        float needed = 2.0f * receiverDistance * pixelsPerUnit / glm::max(cameraDistance, 1e-3f);
+        unsigned int target = minSize;
+        while (target < needed && target < budget)
+            target *= 2;
+        target = std::max(std::min(target, budget), minSize);
+        // shrink only when clearly too large, so the size doesn't flip
+        // every frame around a power of two
+        if (target > size || (target < size && needed < size * 0.4f))
+            resize(target);
+    }
+
+    // draws the casters added since begin() with shader, which is
+    // pointShadowLayerShader or pointShadowShader as explained above
+    void render(Shader &shader)
+    {
+        timer.begin();
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glViewport(0, 0, size, size);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        shader.use();
+        resolveUniforms(shader);
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, farPlane);
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            glm::mat4 view = glm::lookAt(lightPosition, lightPosition + faceDirection(face), faceUp(face));
+            shader.setMat4(shadowMatrixUniforms[face], projection * view);
+        }
+        shader.setVec3(lightPosUniform, lightPosition);
+        shader.setFloat(farPlaneUniform, farPlane);
+
+        // the instances of all groups one after the other
+        unsigned int buffer = instanceVBO, first = 0, generation = 0;
+        size_t total = 0;
+        for (const Group &group : groups)
+            total += group.matrices.size();
+        if (stream)
+        {
+            StreamBuffer::Allocation allocation = stream->allocate(total * sizeof(glm::mat4), sizeof(glm::mat4));
+            glm::mat4 *out = (glm::mat4 *)allocation.data;
+            for (const Group &group : groups)
+                out = std::copy(group.matrices.begin(), group.matrices.end(), out);
+            stream->commit();
+            buffer = stream->buffer;
+            generation = stream->generation;
+            first = allocation.offset / sizeof(glm::mat4);
+        }
+        else
+        {
+            instances.clear();
+            for (const Group &group : groups)
+                instances.insert(instances.end(), group.matrices.begin(), group.matrices.end());
+            glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+            glBufferData(GL_ARRAY_BUFFER, total * sizeof(glm::mat4), instances.data(), GL_STREAM_DRAW);
+        }
+
+        for (const Group &group : groups)
+        {
+            unsigned int count = group.matrices.size();
+            if (!count)
+                continue;
+            for (Mesh &mesh : group.model->meshes)
+            {
+                mesh.setInstanceBuffer(buffer, first, generation);
+                glBindVertexArray(mesh.VAO);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.lods[0].indexCount, mesh.indexType,
+                                                  mesh.indexPointer(mesh.lods[0].indexOffset), count,
+                                                  mesh.baseVertex);
+                stats.drawCalls++;
+            }
+            first += count;
+        }
+        glBindVertexArray(0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        timer.end();
+    }
+
+    // faces of the cube the sphere (offset from the light, radius) reaches,
+    // bit f for face f; conservative, tests the four side planes of each face
+    unsigned int faceMask(glm::vec3 offset, float radius) const
+    {
+        if (glm::length(offset) - radius > farPlane)
+            return 0;
+        const float slack = radius * 1.41421356f;
+        unsigned int mask = 0;
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            int axis = face / 2;
+            float depth = face & 1 ? -offset[axis] : offset[axis];
+            float side1 = std::fabs(offset[(axis + 1) % 3]), side2 = std::fabs(offset[(axis + 2) % 3]);
+            if (depth + slack >= side1 && depth + slack >= side2)
+                mask |= 1u << face;
+        }
+        return mask;
+    }
+
+private:
+    // looks the uniforms up once, not on every render
+    void resolveUniforms(Shader &shader)
+    {
+        if (shader.ID == uniformProgram)
+            return;
+        uniformProgram = shader.ID;
+        for (int face = 0; face < FACE_COUNT; face++)
+            shadowMatrixUniforms[face] = shader.uniform("shadowMatrices[" + std::to_string(face) + "]");
+        lightPosUniform = shader.uniform("lightPos");
+        farPlaneUniform = shader.uniform("farPlane");
+    }
+
+    // the instances of one model, one per caster and face
+    struct Group
+    {
+        Model *model;
+        std::vector<glm::mat4> matrices;
+    };
+
+    glm::vec3 lightPosition = glm::vec3(0.0f);
+    // uniform handles of the program they were looked up in
+    unsigned int uniformProgram = 0;
+    Shader::Uniform shadowMatrixUniforms[FACE_COUNT];
+    Shader::Uniform lightPosUniform, farPlaneUniform;
+    unsigned int FBO = 0;
+    unsigned int instanceVBO = 0;
+    // kept from frame to frame, so their storage is reused
+    std::vector<Group> groups;
+    std::vector<glm::mat4> instances;
+
+    Group &groupOf(Model &model)
+    {
+        for (Group &group : groups)
+            if (group.model == &model)
+                return group;
+        groups.push_back(Group{&model, std::vector<glm::mat4>()});
+        return groups.back();
+    }
+
+    void addInstance(Group &group, const glm::mat4 &matrix)
+    {
+        glm::vec4 sphere = group.model->bounds.sphere(matrix);
+        unsigned int mask = faceMask(glm::vec3(sphere) - lightPosition, sphere.w);
+        stats.casters++;
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            if (!(mask & (1u << face)))
+            {
+                stats.facesCulled++;
+                continue;
+            }
+            glm::mat4 instance = matrix;
+            instance[0][3] = (float)face;
+            group.matrices.push_back(instance);
+            stats.faces++;
+        }
+    }
+
+    // GL_TEXTURE_CUBE_MAP_POSITIVE_X + face order
+    static glm::vec3 faceDirection(int face)
+    {
+        glm::vec3 direction(0.0f);
+        direction[face / 2] = face & 1 ? -1.0f : 1.0f;
+        return direction;
+    }
+
+    static glm::vec3 faceUp(int face)
+    {
+        if (face == 2)
+            return glm::vec3(0.0f, 0.0f, 1.0f);
+        if (face == 3)
+            return glm::vec3(0.0f, 0.0f, -1.0f);
+        return glm::vec3(0.0f, -1.0f, 0.0f);
+    }
+
+    void resize(unsigned int newSize)
+    {
+        size = newSize;
+        if (!depthCubemap)
+            glGenTextures(1, &depthCubemap);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
+        for (int face = 0; face < FACE_COUNT; face++)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT24, size, size, 0,
+                         GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        // compared in hardware, linear filtering blends four results
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        // all six faces attached as layers
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthCubemap, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+
+#endif
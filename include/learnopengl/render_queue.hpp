@@ -0,0 +1,731 @@
+#ifndef RENDER_QUEUE_HPP
+#define RENDER_QUEUE_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "frustum.hpp"
+#include "gl_extensions.hpp"
+#include "gpu_timer.hpp"
+#include "mesh.h"
+#include "model.h"
+#include "shader.h"
+#include "stream_buffer.hpp"
+
+// Collects the draw calls of a frame and executes them in an order that
+// minimizes GL state changes. Every item gets a 64-bit sort key
+//
+//   opaque, sky:  pass:2 | program:10 | material:16 | vertices:16 | depth:20
+//   transparent:  pass:2 | far-to-near depth:20 | program:10 | material:16 | vertices:16
+//
+// so items sharing a program, then textures, then vertex data (the VAO, or
+// the instance buffer of instanced mesh items) end up next to each other, and
+// opaque items with the same state are drawn front to back. The keys are
+// radix sorted, and while executing the queue remembers what is bound and
+// skips binds that would not change anything.
+//
+// Meshes live in geometry buffers shared by all meshes of a vertex format
+// (see Mesh::geometry), so consecutive instanced mesh items that only differ
+// in the mesh, level of detail or instance range are drawn with one
+// glMultiDrawElementsIndirect call when the context supports it, and one
+// glDraw*BaseVertex call each otherwise.
+//
+// Passes run in order: opaque, sky, transparent. With depthPrepass, the
+// opaque meshes are first drawn depth only, and the opaque pass then draws
+// them with GL_EQUAL and no depth writes, so the expensive lighting shaders
+// run once per visible pixel. Meshes whose material may discard fragments
+// (Material::alphaTested) stay out of the prepass and are drawn with the
+// usual depth test: the prepass would lay down depth where the opaque pass
+// then discards, leaving holes. The sky is drawn at maximum depth after all
+// opaque items and only fills what they left uncovered. Each pass is timed on
+// the GPU, see gpuTimes.
+//
+// Mesh items whose bounding sphere lies outside the view frustum are dropped
+// when they are submitted. Models are drawn at the coarsest level of detail
+// whose error, projected to the screen, stays below lodPixelError pixels.
+//
+// Items only reference their shader, mesh and textures, those have to stay
+// alive until flush(). Per-program uniforms other than "model" must be set
+// before flush() and stay the same for the whole frame.
+class RenderQueue
+{
+public:
+    enum Pass
+    {
+        PASS_OPAQUE = 0,
+        // drawn where nothing opaque was, after all opaque items
+        PASS_SKY = 1,
+        // blended, back to front
+        PASS_TRANSPARENT = 2,
+        PASS_COUNT = 3
+    };
+
+    // render state flags of an item
+    enum State
+    {
+        STATE_CULL_BACK = 1,
+        // GL_LEQUAL instead of GL_LESS
+        STATE_DEPTH_LEQUAL = 2,
+        // GL_EQUAL without depth writes, set by the queue on opaque mesh
+        // items after a depth prepass (but not alpha tested ones)
+        STATE_DEPTH_EQUAL = 4
+    };
+
+    enum
+    {
+        MAX_TEXTURES = Material::MAX_TEXTURES
+    };
+
+    // culling results of the current frame and binds issued and skipped by
+    // the last flush()
+    struct Stats
+    {
+        unsigned int items = 0;
+        // meshes (or instances, for instanced draws) in view / outside of it
+        unsigned int submitted = 0, culled = 0;
+        unsigned int programBinds = 0, programBindsSaved = 0;
+        unsigned int vaoBinds = 0, vaoBindsSaved = 0;
+        unsigned int textureBinds = 0, textureBindsSaved = 0;
+        unsigned int stateChanges = 0, stateChangesSaved = 0;
+        // GL draw calls issued, and items drawn by a multi-draw call
+        // without one of their own
+        unsigned int drawCalls = 0, drawsMerged = 0;
+
+        unsigned int bindsSaved() const
+        {
+            return programBindsSaved + vaoBindsSaved + textureBindsSaved + stateChangesSaved;
+        }
+    };
+
+    // GPU time of the passes in milliseconds, a few frames old (see
+    // GpuTimer); prepass is 0 without one
+    struct GpuTimes
+    {
+        float prepass = 0.0f, opaque = 0.0f, sky = 0.0f, transparent = 0.0f;
+
+        float total() const { return prepass + opaque + sky + transparent; }
+    };
+
+    Stats stats;
+    GpuTimes gpuTimes;
+    bool culling = true;
+    // merge instanced draws with glMultiDrawElementsIndirect when available
+    bool multiDraw = true;
+    // where the indirect commands go if set, instead of a buffer of the
+    // queue's own re-specified on every flush
+    StreamBuffer *stream = nullptr;
+    // lay down the depth of opaque meshes with the depth shaders first, so
+    // the opaque pass shades each pixel once (see setDepthShaders)
+    bool depthPrepass = true;
+    Frustum frustum;
+
+    // level of detail selection; a coarser level than the current one is only
+    // taken when its error is below (1 - lodHysteresis) * lodPixelError, so
+    // objects near a boundary don't switch back and forth every frame.
+    // Without it everything is drawn in full detail and the levels remembered
+    // for hysteresis are left alone (for queues of other views than the
+    // camera's).
+    bool lod = true;
+    float lodPixelError = 1.0f;
+    float lodHysteresis = 0.3f;
+    float viewportHeight = 800.0f;
+
+    // camera of the frame: the frustum culls, the view matrix and far plane
+    // give the depth part of keys
+    void begin(const glm::mat4 &projection, const glm::mat4 &view, float farPlane)
+    {
+        this->view = view;
+        this->farPlane = farPlane;
+        frustum = Frustum(projection * view);
+        // pixels covered by one world unit at distance one
+        pixelsPerUnit = projection[1][1] * viewportHeight * 0.5f;
+        stats = Stats();
+        items.clear();
+    }
+
+    // depth only programs for the prepass, drawing with the same vertex
+    // transform as the regular mesh shaders: a "model" uniform, or the
+    // instance matrix at attribute location 5. Without them there is no
+    // prepass.
+    void setDepthShaders(Shader &depth, Shader &instancedDepth)
+    {
+        depthShader = &depth;
+        instancedDepthShader = &instancedDepth;
+    }
+
+    // records the result of culling done by the caller
+    void countCulled(unsigned int submitted, unsigned int culled)
+    {
+        stats.submitted += submitted;
+        stats.culled += culled;
+    }
+
+    // level of detail of model for an instance with bounding sphere
+    // (center, radius) in world space, given the level it had last frame
+    unsigned int selectLod(const Model &model, glm::vec4 sphere, unsigned int current) const
+    {
+        if (!lod || model.lodErrors.size() < 2)
+            return 0;
+        float depth = -(view * glm::vec4(glm::vec3(sphere), 1.0f)).z;
+        if (depth <= sphere.w)
+            return 0;
+        // size of the model on screen in pixels; lodErrors are relative to it
+        float screenRadius = sphere.w * pixelsPerUnit / depth;
+        unsigned int level = 0;
+        for (unsigned int i = 1; i < model.lodErrors.size(); i++)
+        {
+            float limit = i > current ? lodPixelError * (1.0f - lodHysteresis) : lodPixelError;
+            if (model.lodErrors[i] * screenRadius > limit)
+                break;
+            level = i;
+        }
+        return level;
+    }
+
+    // one mesh with its own model matrix, at level of detail level
+    void submit(Shader &shader, Mesh &mesh, const glm::mat4 &model,
+                Pass pass = PASS_OPAQUE, unsigned int state = 0, unsigned int level = 0)
+    {
+        if (culling && !frustum.intersectsSphere(mesh.bounds.sphere(model)))
+        {
+            stats.culled++;
+            return;
+        }
+        stats.submitted++;
+        Item &item = addMeshItem(shader, mesh, pass, state, level);
+        item.model = model;
+        item.key = makeKey(item, viewDepth(model));
+    }
+
+    // currentLod is the level this copy of the model had last frame, updated
+    // with the one picked now; every place submitting the model keeps its
+    // own, since copies at different distances need different levels.
+    // Without it the level is picked without hysteresis.
+    void submit(Shader &shader, Model &model, const glm::mat4 &matrix,
+                Pass pass = PASS_OPAQUE, unsigned int state = 0, unsigned int *currentLod = nullptr)
+    {
+        unsigned int level = 0;
+        if (lod)
+        {
+            level = selectLod(model, model.bounds.sphere(matrix), currentLod ? *currentLod : 0);
+            if (currentLod)
+                *currentLod = level;
+        }
+        for (Mesh &mesh : model.meshes)
+            submit(shader, mesh, matrix, pass, state, level);
+    }
+
+    // instanceCount copies of every mesh of model at level of detail level,
+    // with model matrices taken from instanceBuffer starting at firstInstance
+    // (see Mesh::setInstanceBuffer)
+    void submitInstanced(Shader &shader, Model &model, unsigned int instanceBuffer,
+                         unsigned int instanceCount, Pass pass = PASS_OPAQUE, unsigned int state = 0,
+                         unsigned int level = 0, unsigned int firstInstance = 0, unsigned int generation = 0)
+    {
+        if (!instanceCount)
+            return;
+        for (Mesh &mesh : model.meshes)
+        {
+            Item &item = addMeshItem(shader, mesh, pass, state, level);
+            item.instanceBuffer = instanceBuffer;
+            item.instanceOffset = firstInstance;
+            item.instanceGeneration = generation;
+            item.instanceCount = instanceCount;
+            // instances are spread out, there is no single depth to sort by
+            item.key = makeKey(item, 0.0f);
+        }
+    }
+
+    // a draw without a Mesh: count indices (GL_UNSIGNED_INT) from the element
+    // buffer of vao, or count vertices if indexed is false, with one texture
+    // on unit 0
+    void submit(Shader &shader, unsigned int vao, unsigned int count, bool indexed,
+                GLenum textureTarget, unsigned int texture, const glm::mat4 &model,
+                Pass pass = PASS_OPAQUE, unsigned int state = 0)
+    {
+        Item item;
+        item.shader = &shader;
+        item.vao = vao;
+        item.count = count;
+        item.indexed = indexed;
+        item.textureTarget = textureTarget;
+        item.textures[0] = texture;
+        item.textureCount = 1;
+        item.model = model;
+        item.pass = pass;
+        item.state = state;
+        item.key = makeKey(item, viewDepth(model));
+        items.push_back(item);
+    }
+
+    // instanceCount instances of a draw without a Mesh, like the one above
+    // but indexed; the per-instance attributes are set up in vao itself
+    void submitInstanced(Shader &shader, unsigned int vao, unsigned int count, GLenum textureTarget,
+                         unsigned int texture, unsigned int instanceCount, Pass pass = PASS_OPAQUE,
+                         unsigned int state = 0)
+    {
+        if (!instanceCount)
+            return;
+        Item item;
+        item.shader = &shader;
+        item.vao = vao;
+        item.count = count;
+        item.instanceCount = instanceCount;
+        item.textureTarget = textureTarget;
+        item.textures[0] = texture;
+        item.textureCount = 1;
+        item.pass = pass;
+        item.state = state;
+        item.key = makeKey(item, 0.0f);
+        items.push_back(item);
+    }
+
+    // sorts and executes everything submitted since begin()
+    void flush()
+    {
+        prepare();
+        bool prepass = depthPrepass && depthShader && instancedDepthShader;
+        size_t passStart[PASS_COUNT + 1];
+        passRanges(passStart);
+
+        if (prepass)
+        {
+            prepassTimer.begin();
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            execute(passStart[PASS_OPAQUE], passStart[PASS_OPAQUE + 1], true, true);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            prepassTimer.end();
+        }
+        for (int pass = 0; pass < PASS_COUNT; pass++)
+        {
+            passTimers[pass].begin();
+            execute(passStart[pass], passStart[pass + 1], false, prepass);
+            passTimers[pass].end();
+        }
+        gpuTimes.prepass = prepass ? prepassTimer.milliseconds : 0.0f;
+        gpuTimes.opaque = passTimers[PASS_OPAQUE].milliseconds;
+        gpuTimes.sky = passTimers[PASS_SKY].milliseconds;
+        gpuTimes.transparent = passTimers[PASS_TRANSPARENT].milliseconds;
+        finish();
+    }
+
+    // draws only the opaque mesh items submitted since begin(), with the
+    // depth shaders, e.g. into a shadow map; everything else is dropped
+    void flushDepth()
+    {
+        prepare();
+        size_t passStart[PASS_COUNT + 1];
+        passRanges(passStart);
+        if (depthShader && instancedDepthShader)
+            execute(passStart[PASS_OPAQUE], passStart[PASS_OPAQUE + 1], true);
+        finish();
+    }
+
+private:
+    struct Item
+    {
+        uint64_t key = 0;
+        Shader *shader = nullptr;
+        // set for mesh items, its material provides the sampler uniforms
+        Mesh *mesh = nullptr;
+        unsigned int vao = 0;
+        unsigned int count = 0;
+        unsigned int indexOffset = 0;
+        GLenum indexType = GL_UNSIGNED_INT;
+        int baseVertex = 0;
+        bool indexed = true;
+        unsigned int instanceBuffer = 0;
+        unsigned int instanceOffset = 0;
+        unsigned int instanceGeneration = 0;
+        // 0 for a single draw using model
+        unsigned int instanceCount = 0;
+        GLenum textureTarget = GL_TEXTURE_2D;
+        unsigned int textures[MAX_TEXTURES];
+        unsigned int textureCount = 0;
+        glm::mat4 model;
+        Pass pass = PASS_OPAQUE;
+        unsigned int state = 0;
+        // items drawn by one multi-draw call starting at this one, and the
+        // index of its first command in the indirect buffer
+        unsigned int batchSize = 1;
+        unsigned int firstCommand = 0;
+    };
+
+    std::vector<Item> items;
+    // item indices in execution order, and scratch space for sorting
+    std::vector<uint32_t> order, orderScratch;
+    std::vector<uint64_t> keys, keysScratch;
+    std::vector<DrawElementsIndirectCommand> commands;
+    unsigned int indirectBuffer = 0;
+    // byte offset of commands[0] in the bound indirect buffer
+    size_t commandOffset = 0;
+    glm::mat4 view = glm::mat4(1.0f);
+    float farPlane = 100.0f;
+    float pixelsPerUnit = 1.0f;
+    Shader *depthShader = nullptr;
+    Shader *instancedDepthShader = nullptr;
+    GpuTimer prepassTimer;
+    GpuTimer passTimers[PASS_COUNT];
+
+    // what is bound while executing, so that binds that change nothing are
+    // skipped
+    struct Bound
+    {
+        unsigned int program = ~0u, vao = ~0u, activeUnit = ~0u;
+        unsigned int state = ~0u;
+        unsigned int textures[MAX_TEXTURES];
+        Shader::Uniform modelUniform;
+
+        Bound()
+        {
+            for (unsigned int i = 0; i < MAX_TEXTURES; i++)
+                textures[i] = ~0u;
+        }
+    };
+    Bound bound;
+
+    // "model" uniform handles, looked up once per program
+    std::vector<std::pair<unsigned int, Shader::Uniform>> modelUniforms;
+
+    Item &addMeshItem(Shader &shader, Mesh &mesh, Pass pass, unsigned int state, unsigned int level)
+    {
+        const MeshLod &lod = mesh.lods[std::min<size_t>(level, mesh.lods.size() - 1)];
+        items.push_back(Item());
+        Item &item = items.back();
+        item.shader = &shader;
+        item.mesh = &mesh;
+        item.vao = mesh.VAO;
+        item.count = lod.indexCount;
+        item.indexOffset = mesh.firstIndex + lod.indexOffset;
+        item.indexType = mesh.indexType;
+        item.baseVertex = mesh.baseVertex;
+        item.textureTarget = mesh.material.textureTarget;
+        item.textureCount = mesh.material.textureCount;
+        for (unsigned int i = 0; i < item.textureCount; i++)
+            item.textures[i] = mesh.material.textures[i];
+        item.pass = pass;
+        item.state = state;
+        return item;
+    }
+
+    float viewDepth(const glm::mat4 &model) const
+    {
+        // distance in front of the camera of the model's origin
+        return -(view * model[3]).z;
+    }
+
+    uint64_t makeKey(const Item &item, float depth) const
+    {
+        uint64_t pass = item.pass;
+        uint64_t program = item.shader->ID & 0x3ff;
+        // the first texture stands for the material
+        uint64_t material = item.textureCount ? item.textures[0] & 0xffff : 0;
+        uint64_t vao = (item.mesh && item.instanceCount ? item.instanceBuffer : item.vao) & 0xffff;
+        uint64_t quantized = (uint64_t)(glm::clamp(depth / farPlane, 0.0f, 1.0f) * 0xfffff);
+
+        if (item.pass == PASS_TRANSPARENT)
+            return pass << 62 | (0xfffff - quantized) << 42 | program << 32 | material << 16 | vao;
+        return pass << 62 | program << 52 | material << 36 | vao << 20 | quantized;
+    }
+
+    void prepare()
+    {
+        stats.items = items.size();
+        sort();
+        commands.clear();
+        if (multiDraw && glExtensions().multiDrawIndirect)
+            buildCommands();
+        // unknown state at the start, the first bind of everything is issued
+        bound = Bound();
+    }
+
+    // leaves the defaults the rest of the code expects
+    void finish()
+    {
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+        applyState(0, bound.state);
+        if (!commands.empty())
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        items.clear();
+    }
+
+    // start of the items of every pass in order, passStart[PASS_COUNT] is the
+    // end of the last
+    void passRanges(size_t passStart[PASS_COUNT + 1]) const
+    {
+        size_t position = 0;
+        for (int pass = 0; pass < PASS_COUNT; pass++)
+        {
+            while (position < order.size() && items[order[position]].pass < pass)
+                position++;
+            passStart[pass] = position;
+        }
+        passStart[PASS_COUNT] = order.size();
+    }
+
+    // executes order[begin..end). depthOnly draws only the mesh items, with
+    // the depth shaders and no textures. With prepass, the frame has a depth
+    // prepass: a depth only execute is that prepass and leaves out the alpha
+    // tested meshes, otherwise the other opaque mesh items test for equal
+    // depth against what the prepass wrote.
+    void execute(size_t begin, size_t end, bool depthOnly, bool prepass = false)
+    {
+        for (size_t position = begin; position < end; position++)
+        {
+            Item &item = items[order[position]];
+            if (depthOnly && !item.mesh)
+                continue;
+            bool inPrepass = prepass && item.mesh && item.pass == PASS_OPAQUE && !item.mesh->material.alphaTested;
+            if (depthOnly && prepass && !inPrepass)
+                continue;
+            Shader &shader = !depthOnly ? *item.shader : item.instanceCount ? *instancedDepthShader : *depthShader;
+
+            unsigned int state = item.state;
+            if (!depthOnly && inPrepass)
+                state |= STATE_DEPTH_EQUAL;
+            if (state != bound.state)
+            {
+                applyState(state, bound.state);
+                bound.state = state;
+                stats.stateChanges++;
+            }
+            else
+            {
+                stats.stateChangesSaved++;
+            }
+
+            if (shader.ID != bound.program)
+            {
+                shader.use();
+                bound.program = shader.ID;
+                bound.modelUniform = modelUniformOf(shader);
+                stats.programBinds++;
+            }
+            else
+            {
+                stats.programBindsSaved++;
+            }
+
+            // multi-draw commands select their instances with baseInstance
+            unsigned int instanceOffset = item.batchSize > 1 ? 0 : item.instanceOffset;
+            if (item.mesh)
+            {
+                if (!depthOnly)
+                    item.mesh->material.setSamplers(shader);
+                GeometryBuffer &geometry = item.mesh->geometry();
+                if (item.instanceCount && (geometry.instanceBuffer != item.instanceBuffer ||
+                                           geometry.instanceOffset != instanceOffset ||
+                                           geometry.instanceGeneration != item.instanceGeneration))
+                {
+                    // attaching the buffer binds and then unbinds the VAO
+                    geometry.setInstanceBuffer(item.instanceBuffer, instanceOffset, item.instanceGeneration);
+                    bound.vao = 0;
+                }
+            }
+
+            for (unsigned int unit = 0; !depthOnly && unit < item.textureCount; unit++)
+            {
+                // units past the ones used by the previous item keep whatever
+                // was bound to them, the shader doesn't sample them
+                if (bound.textures[unit] == item.textures[unit])
+                {
+                    stats.textureBindsSaved++;
+                    continue;
+                }
+                if (bound.activeUnit != unit)
+                {
+                    glActiveTexture(GL_TEXTURE0 + unit);
+                    bound.activeUnit = unit;
+                }
+                glBindTexture(item.textureTarget, item.textures[unit]);
+                bound.textures[unit] = item.textures[unit];
+                stats.textureBinds++;
+            }
+
+            if (item.vao != bound.vao)
+            {
+                glBindVertexArray(item.vao);
+                bound.vao = item.vao;
+                stats.vaoBinds++;
+            }
+            else
+            {
+                stats.vaoBindsSaved++;
+            }
+
+            stats.drawCalls++;
+            if (item.batchSize > 1)
+            {
+                // the rest of the batch has the same state, skip over it
+                glExtensions().MultiDrawElementsIndirect(
+                    GL_TRIANGLES, item.indexType,
+                    (const void *)(commandOffset + item.firstCommand * sizeof(DrawElementsIndirectCommand)),
+                    item.batchSize, 0);
+                stats.drawsMerged += item.batchSize - 1;
+                position += item.batchSize - 1;
+                continue;
+            }
+            size_t indexSize = item.indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+            const void *firstIndex = (const void *)(item.indexOffset * indexSize);
+            if (item.instanceCount)
+            {
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, item.count, item.indexType, firstIndex,
+                                                  item.instanceCount, item.baseVertex);
+                continue;
+            }
+            shader.setMat4(bound.modelUniform, item.model);
+            if (item.indexed)
+                glDrawElementsBaseVertex(GL_TRIANGLES, item.count, item.indexType, firstIndex, item.baseVertex);
+            else
+                glDrawArrays(GL_TRIANGLES, 0, item.count);
+        }
+    }
+
+    // whether b can be drawn by the same multi-draw call as a: instanced
+    // items of the shared geometry with the same program, textures (and
+    // texture array layers, which are uniforms), state and instance buffer
+    static bool mergeable(const Item &a, const Item &b)
+    {
+        if (!a.mesh || !b.mesh || !a.instanceCount || !b.instanceCount)
+            return false;
+        if (a.pass != b.pass || a.shader->ID != b.shader->ID || a.vao != b.vao || a.state != b.state ||
+            a.instanceBuffer != b.instanceBuffer || a.textureCount != b.textureCount)
+            return false;
+        for (unsigned int i = 0; i < a.textureCount; i++)
+            if (a.textures[i] != b.textures[i])
+                return false;
+        if (a.textureTarget == GL_TEXTURE_2D_ARRAY)
+            for (unsigned int i = 0; i < a.textureCount; i++)
+                if (a.mesh->material.layers[i] != b.mesh->material.layers[i])
+                    return false;
+        return true;
+    }
+
+    // groups runs of mergeable items in execution order into batches and
+    // uploads one indirect command per batched item
+    void buildCommands()
+    {
+        for (size_t start = 0; start < order.size();)
+        {
+            Item &first = items[order[start]];
+            size_t end = start + 1;
+            while (end < order.size() && mergeable(first, items[order[end]]))
+                end++;
+            if (end - start > 1)
+            {
+                first.batchSize = end - start;
+                first.firstCommand = commands.size();
+                for (size_t position = start; position < end; position++)
+                {
+                    const Item &item = items[order[position]];
+                    DrawElementsIndirectCommand command;
+                    command.count = item.count;
+                    command.instanceCount = item.instanceCount;
+                    command.firstIndex = item.indexOffset;
+                    command.baseVertex = item.baseVertex;
+                    command.baseInstance = item.instanceOffset;
+                    commands.push_back(command);
+                }
+            }
+            start = end;
+        }
+        if (commands.empty())
+            return;
+
+        size_t size = commands.size() * sizeof(DrawElementsIndirectCommand);
+        if (stream)
+        {
+            StreamBuffer::Allocation allocation = stream->allocate(size, sizeof(GLuint));
+            std::memcpy(allocation.data, commands.data(), size);
+            stream->commit();
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, stream->buffer);
+            commandOffset = allocation.offset;
+            return;
+        }
+        commandOffset = 0;
+        if (!indirectBuffer)
+            glGenBuffers(1, &indirectBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        // a new store every frame, the previous one may still be in use
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, size, commands.data(), GL_STREAM_DRAW);
+    }
+
+    // LSD radix sort of the keys, one byte per pass; passes where every key
+    // has the same byte are skipped, which is most of them for small queues
+    void sort()
+    {
+        size_t count = items.size();
+        order.resize(count);
+        orderScratch.resize(count);
+        keys.resize(count);
+        keysScratch.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            order[i] = i;
+            keys[i] = items[i].key;
+        }
+
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t histogram[256] = {0};
+            for (size_t i = 0; i < count; i++)
+                histogram[(keys[i] >> shift) & 0xff]++;
+            if (count == 0 || histogram[(keys[0] >> shift) & 0xff] == count)
+                continue;
+
+            size_t offset = 0;
+            for (int digit = 0; digit < 256; digit++)
+            {
+                size_t digitCount = histogram[digit];
+                histogram[digit] = offset;
+                offset += digitCount;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                size_t target = histogram[(keys[i] >> shift) & 0xff]++;
+                keysScratch[target] = keys[i];
+                orderScratch[target] = order[i];
+            }
+            keys.swap(keysScratch);
+            order.swap(orderScratch);
+        }
+    }
+
+    void applyState(unsigned int state, unsigned int previous)
+    {
+        unsigned int changed = state ^ previous;
+        if (changed & STATE_CULL_BACK)
+        {
+            if (state & STATE_CULL_BACK)
+            {
+                glEnable(GL_CULL_FACE);
+                glCullFace(GL_BACK);
+            }
+            else
+            {
+                glDisable(GL_CULL_FACE);
+            }
+        }
+        if (changed & (STATE_DEPTH_LEQUAL | STATE_DEPTH_EQUAL))
+            glDepthFunc(state & STATE_DEPTH_EQUAL ? GL_EQUAL : state & STATE_DEPTH_LEQUAL ? GL_LEQUAL : GL_LESS);
+        if (changed & STATE_DEPTH_EQUAL)
+            glDepthMask(state & STATE_DEPTH_EQUAL ? GL_FALSE : GL_TRUE);
+    }
+
+    Shader::Uniform modelUniformOf(Shader &shader)
+    {
+        for (auto &entry : modelUniforms)
+            if (entry.first == shader.ID)
+                return entry.second;
+        modelUniforms.emplace_back(shader.ID, shader.uniform("model"));
+        return modelUniforms.back().second;
+    }
+};
+
+#endif
@@ -8,11 +8,21 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
 #include <common.h>
 class Shader
 {
 public:
     unsigned int ID;
+    // pre-resolved uniform, returned by uniform(); an invalid handle (a name the
+    // program doesn't use) is accepted by all setters and ignored
+    struct Uniform
+    {
+        int index = -1;
+        bool valid() const { return index >= 0; }
+    };
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
@@ -102,6 +112,7 @@ public:
         if(geometryPath != nullptr)
             glDeleteShader(geometry);
 
+        resolveUniforms();
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -109,66 +120,195 @@ public:
     { 
         glUseProgram(ID); 
     }
+    // looks up a uniform once, the handle can then be passed to the setters
+    // ------------------------------------------------------------------------
+    Uniform uniform(const std::string &name) const
+    {
+        Uniform handle;
+        auto it = uniformIndex.find(name);
+        if (it != uniformIndex.end())
+            handle.index = it->second;
+        return handle;
+    }
+    // attaches the uniform block called name to a uniform buffer binding point
+    // ------------------------------------------------------------------------
+    void bindUniformBlock(const std::string &name, unsigned int binding)
+    {
+        unsigned int index = glGetUniformBlockIndex(ID, name.c_str());
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
+    }
     // utility uniform functions
+    // every setter keeps a copy of the last value it uploaded and skips the GL
+    // call when the value hasn't changed. like glUniform* they act on this
+    // program, which has to be in use.
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(Uniform u, bool value)
+    {
+        setInt(u, (int)value);
+    }
+    void setBool(const std::string &name, bool value)
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        setBool(uniform(name), value);
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(Uniform u, int value)
+    {
+        if (changed(u, &value, sizeof(value)))
+            glUniform1i(uniforms[u.index].location, value);
+    }
+    void setInt(const std::string &name, int value)
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        setInt(uniform(name), value);
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(Uniform u, float value)
+    {
+        if (changed(u, &value, sizeof(value)))
+            glUniform1f(uniforms[u.index].location, value);
+    }
+    void setFloat(const std::string &name, float value)
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        setFloat(uniform(name), value);
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(Uniform u, const glm::vec2 &value)
+    {
+        if (changed(u, &value[0], sizeof(value)))
+            glUniform2fv(uniforms[u.index].location, 1, &value[0]);
+    }
+    void setVec2(const std::string &name, const glm::vec2 &value)
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec2(uniform(name), value);
     }
-    void setVec2(const std::string &name, float x, float y) const
+    void setVec2(const std::string &name, float x, float y)
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        setVec2(uniform(name), glm::vec2(x, y));
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(Uniform u, const glm::vec3 &value)
+    {
+        if (changed(u, &value[0], sizeof(value)))
+            glUniform3fv(uniforms[u.index].location, 1, &value[0]);
+    }
+    void setVec3(const std::string &name, const glm::vec3 &value)
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec3(uniform(name), value);
     }
-    void setVec3(const std::string &name, float x, float y, float z) const
+    void setVec3(const std::string &name, float x, float y, float z)
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        setVec3(uniform(name), glm::vec3(x, y, z));
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(Uniform u, const glm::vec4 &value)
+    {
+        if (changed(u, &value[0], sizeof(value)))
+            glUniform4fv(uniforms[u.index].location, 1, &value[0]);
+    }
+    void setVec4(const std::string &name, const glm::vec4 &value)
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec4(uniform(name), value);
     }
     void setVec4(const std::string &name, float x, float y, float z, float w) 
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        setVec4(uniform(name), glm::vec4(x, y, z, w));
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat2(Uniform u, const glm::mat2 &mat)
+    {
+        if (changed(u, &mat[0][0], sizeof(mat)))
+            glUniformMatrix2fv(uniforms[u.index].location, 1, GL_FALSE, &mat[0][0]);
+    }
+    void setMat2(const std::string &name, const glm::mat2 &mat)
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat2(uniform(name), mat);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat3(Uniform u, const glm::mat3 &mat)
+    {
+        if (changed(u, &mat[0][0], sizeof(mat)))
+            glUniformMatrix3fv(uniforms[u.index].location, 1, GL_FALSE, &mat[0][0]);
+    }
+    void setMat3(const std::string &name, const glm::mat3 &mat)
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat3(uniform(name), mat);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    void setMat4(Uniform u, const glm::mat4 &mat)
+    {
+        if (changed(u, &mat[0][0], sizeof(mat)))
+            glUniformMatrix4fv(uniforms[u.index].location, 1, GL_FALSE, &mat[0][0]);
+    }
+    void setMat4(const std::string &name, const glm::mat4 &mat)
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat4(uniform(name), mat);
     }
 
 private:
+    // an active uniform of the program with the value last uploaded to it
+    struct UniformState
+    {
+        GLint location;
+        bool uploaded = false;
+        unsigned char value[sizeof(glm::mat4)];
+    };
+    std::vector<UniformState> uniforms;
+    std::unordered_map<std::string, int> uniformIndex;
+
+    // asks the program for all its active uniforms once, right after linking
+    // ------------------------------------------------------------------------
+    void resolveUniforms()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> buffer(maxLength + 1);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(ID, i, buffer.size(), nullptr, &size, &type, buffer.data());
+            std::string name(buffer.data());
+            // uniforms in blocks have no location
+            GLint location = glGetUniformLocation(ID, name.c_str());
+            if (location == -1)
+                continue;
+            addUniform(name, location);
+
+            // arrays are reported once as "name[0]", register every element
+            // and the plain name
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                std::string base = name.substr(0, name.size() - 3);
+                uniformIndex[base] = uniformIndex[name];
+                for (GLint element = 1; element < size; element++)
+                {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    addUniform(elementName, glGetUniformLocation(ID, elementName.c_str()));
+                }
+            }
+        }
+    }
+    void addUniform(const std::string &name, GLint location)
+    {
+        UniformState state;
+        state.location = location;
+        uniformIndex[name] = uniforms.size();
+        uniforms.push_back(state);
+    }
+    // records value as the current one, returns false if it was already set
+    // ------------------------------------------------------------------------
+    bool changed(Uniform u, const void *value, size_t size)
+    {
+        if (!u.valid())
+            return false;
+        UniformState &state = uniforms[u.index];
+        if (state.uploaded && std::memcmp(state.value, value, size) == 0)
+            return false;
+        std::memcpy(state.value, value, size);
+        state.uploaded = true;
+        return true;
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,290 @@
+#ifndef SHADOW_CASCADES_HPP
+#define SHADOW_CASCADES_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <functional>
+#include <limits>
+
+#include "frustum.hpp"
+#include "render_queue.hpp"
+#include "shader.h"
+
+// Cascaded shadow maps for a directional light. The view frustum up to
+// shadowDistance is split into CASCADE_COUNT slices, each covered by an
+// orthographic light projection rendered into one layer of a depth texture
+// array (sampled as sampler2DArrayShadow).
+//
+// Most casters never move, so every cascade keeps a second depth layer with
+// only the static casters. Cascades are fitted with some slack around the
+// bounding sphere of their slice and only refitted when the slice leaves it,
+// so while the camera moves within the slack, the light stays the same and
+// invalidateStatic() isn't called, the static layer is reused: each frame it
+// is copied into the shadow map and only the dynamic casters are drawn on
+// top of it.
+class ShadowCascades
+{
+public:
+    enum
+    {
+        CASCADE_COUNT = 3
+    };
+
+    // casters drawn each frame vs only when the static layers are invalid
+    enum Casters
+    {
+        CASTERS_STATIC,
+        CASTERS_DYNAMIC
+    };
+
+    // shadows end this far from the camera
+    float shadowDistance = 20.0f;
+    // 0 splits the distance evenly, 1 logarithmically
+    float splitLambda = 0.75f;
+    // extra room around a cascade's slice, relative to its radius
+    float slack = 0.3f;
+
+    unsigned int shadowMap = 0;
+    const unsigned int size;
+    // world to light clip space of every cascade, and the view depth where
+    // each one ends
+    glm::mat4 lightMatrices[CASCADE_COUNT];
+    float splits[CASCADE_COUNT];
+
+    // static layers redrawn in the last render()
+    unsigned int staticRenders = 0;
+    // for the indirect commands of the caster queue, see RenderQueue::stream
+    StreamBuffer *stream = nullptr;
+
+    ShadowCascades(unsigned int size = 1024) : size(size)
+    {
+        shadowMap = createDepthArray(true);
+        staticMap = createDepthArray(false);
+        // depth only, no color buffers to draw to or read from
+        unsigned int fbos[2];
+        glGenFramebuffers(2, fbos);
+        drawFBO = fbos[0];
+        readFBO = fbos[1];
+        for (unsigned int fbo : fbos)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        for (int c = 0; c < CASCADE_COUNT; c++)
+            staticValid[c] = false;
+        queue.lod = false;
+    }
+
+    // the static casters changed, all static layers are redrawn
+    void invalidateStatic()
+    {
+        for (int c = 0; c < CASCADE_COUNT; c++)
+            staticValid[c] = false;
+    }
+
+    // fits the cascades to the camera; casters must lie within sceneBounds
+    void update(const glm::mat4 &view, float fovY, float aspect, float nearPlane, glm::vec3 lightDirection,
+                const Bounds &sceneBounds)
+    {
+        lightDirection = glm::normalize(lightDirection);
+        if (lightDirection != this->lightDirection || sceneBounds.min != bounds.min || sceneBounds.max != bounds.max)
+        {
+            this->lightDirection = lightDirection;
+            bounds = sceneBounds;
+            glm::vec3 up = std::fabs(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            lightView = glm::lookAt(bounds.center() - lightDirection, bounds.center(), up);
+            // depth range of the scene seen from the light
+            lightNear = std::numeric_limits<float>::max();
+            lightFar = -std::numeric_limits<float>::max();
+            for (int corner = 0; corner < 8; corner++)
+            {
+                glm::vec3 point(corner & 1 ? bounds.max.x : bounds.min.x, corner & 2 ? bounds.max.y : bounds.min.y,
+                                corner & 4 ? bounds.max.z : bounds.min.z);
+                float depth = -(lightView * glm::vec4(point, 1.0f)).z;
+                lightNear = glm::min(lightNear, depth);
+                lightFar = glm::max(lightFar, depth);
+            }
+            lightNear -= 0.1f;
+            lightFar += 0.1f;
+            for (int c = 0; c < CASCADE_COUNT; c++)
+                halfSize[c] = 0.0f;
+            invalidateStatic();
+        }
+
+        glm::mat4 inverseView = glm::inverse(view);
+        float tanY = std::tan(fovY * 0.5f), tanX = tanY * aspect;
+        float sliceNear = nearPlane;
+        for (int c = 0; c < CASCADE_COUNT; c++)
+        {
+            float i = (float)(c + 1) / CASCADE_COUNT;
+            float logarithmic = nearPlane * std::pow(shadowDistance / nearPlane, i);
+            float uniform = nearPlane + (shadowDistance - nearPlane) * i;
+            float sliceFar = splitLambda * logarithmic + (1.0f - splitLambda) * uniform;
+            splits[c] = sliceFar;
+
+            // bounding sphere of the slice, in light space; its radius only
+            // depends on the projection, so it doesn't change as the camera turns
+            glm::vec3 corners[8];
+            glm::vec3 center(0.0f);
+            for (int corner = 0; corner < 8; corner++)
+            {
+                float depth = corner & 4 ? sliceFar : sliceNear;
+                glm::vec4 point(depth * tanX * (corner & 1 ? 1.0f : -1.0f), depth * tanY * (corner & 2 ? 1.0f : -1.0f),
+                                -depth, 1.0f);
+                corners[corner] = glm::vec3(lightView * inverseView * point);
+                center += corners[corner];
+            }
+            center /= 8.0f;
+            float radius = 0.0f;
+            for (const glm::vec3 &corner : corners)
+                radius = glm::max(radius, glm::length(corner - center));
+            sliceNear = sliceFar;
+
+            // refit when the slice pokes out of the box, or the box has gotten
+            // much too big for it (after zooming in)
+            glm::vec2 offset = glm::abs(glm::vec2(center) - boxCenter[c]);
+            if (glm::max(offset.x, offset.y) + radius > halfSize[c] || radius * (1.0f + 2.0f * slack) < halfSize[c])
+            {
+                halfSize[c] = radius * (1.0f + slack);
+                boxCenter[c] = glm::vec2(center);
+                staticValid[c] = false;
+            }
+            glm::mat4 projection = glm::ortho(boxCenter[c].x - halfSize[c], boxCenter[c].x + halfSize[c],
+                                              boxCenter[c].y - halfSize[c], boxCenter[c].y + halfSize[c],
+                                              lightNear, lightFar);
+            lightProjections[c] = projection;
+            lightMatrices[c] = projection * lightView;
+        }
+    }
+
+    // draws the shadow map; submit puts the static or the dynamic casters
+    // into the queue it gets. depthShader and instancedDepthShader transform
+    // with the "lightSpace" uniform and a "model" uniform or instance
+    // matrices at location 5.
+    void render(Shader &depthShader, Shader &instancedDepthShader,
+                const std::function<void(RenderQueue &queue, Casters casters)> &submit)
+    {
+        queue.setDepthShaders(depthShader, instancedDepthShader);
+        queue.stream = stream;
+        staticRenders = 0;
+
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glViewport(0, 0, size, size);
+        // against acne on slopes facing away from the light
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1.5f, 2.0f);
+
+        lightSpace.resolve(depthShader);
+        instancedLightSpace.resolve(instancedDepthShader);
+        for (int c = 0; c < CASCADE_COUNT; c++)
+        {
+            depthShader.use();
+            depthShader.setMat4(lightSpace.uniform, lightMatrices[c]);
+            instancedDepthShader.use();
+            instancedDepthShader.setMat4(instancedLightSpace.uniform, lightMatrices[c]);
+
+            if (!staticValid[c])
+            {
+                bindLayer(GL_FRAMEBUFFER, drawFBO, staticMap, c);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                draw(c, CASTERS_STATIC, submit);
+                staticValid[c] = true;
+                staticRenders++;
+            }
+
+            // start from the static casters
+            bindLayer(GL_READ_FRAMEBUFFER, readFBO, staticMap, c);
+            bindLayer(GL_DRAW_FRAMEBUFFER, drawFBO, shadowMap, c);
+            glBlitFramebuffer(0, 0, size, size, 0, 0, size, size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            draw(c, CASTERS_DYNAMIC, submit);
+        }
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+
+    // the cascades as the receiving shaders expect them: the end of every
+    // cascade in view depth, w 1 when shadows are on
+    glm::vec4 splitsUniform(bool enabled) const
+    {
+        return glm::vec4(splits[0], splits[1], splits[2], enabled ? 1.0f : 0.0f);
+    }
+
+private:
+    // the "lightSpace" handle of a depth shader, looked up once per program
+    struct LightSpaceUniform
+    {
+        unsigned int program = 0;
+        Shader::Uniform uniform;
+
+        void resolve(Shader &shader)
+        {
+            if (shader.ID == program)
+                return;
+            program = shader.ID;
+            uniform = shader.uniform("lightSpace");
+        }
+    };
+
+    LightSpaceUniform lightSpace, instancedLightSpace;
+    unsigned int staticMap = 0;
+    unsigned int drawFBO = 0, readFBO = 0;
+    bool staticValid[CASCADE_COUNT];
+    RenderQueue queue;
+
+    glm::vec3 lightDirection = glm::vec3(0.0f);
+    Bounds bounds;
+    glm::mat4 lightView = glm::mat4(1.0f);
+    float lightNear = 0.0f, lightFar = 1.0f;
+    glm::vec2 boxCenter[CASCADE_COUNT];
+    float halfSize[CASCADE_COUNT] = {0.0f};
+    glm::mat4 lightProjections[CASCADE_COUNT];
+
+    void draw(int cascade, Casters casters, const std::function<void(RenderQueue &queue, Casters casters)> &submit)
+    {
+        queue.begin(lightProjections[cascade], lightView, lightFar);
+        submit(queue, casters);
+        queue.flushDepth();
+    }
+
+    unsigned int createDepthArray(bool compare)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, CASCADE_COUNT, 0, GL_DEPTH_COMPONENT,
+                     GL_FLOAT, nullptr);
+        // linear filtering with comparison gives 2x2 PCF for free
+        GLint filter = compare ? GL_LINEAR : GL_NEAREST;
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, filter);
+        // outside the map counts as lit
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        float border[] = {1.0f, 1.0f, 1.0f, 1.0f};
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        if (compare)
+        {
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        return texture;
+    }
+
+    static void bindLayer(GLenum target, unsigned int fbo, unsigned int texture, int layer)
+    {
+        glBindFramebuffer(target, fbo);
+        glFramebufferTextureLayer(target, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+    }
+};
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef SPATIAL_HASH_HPP
+#define SPATIAL_HASH_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "job_system.hpp"
+
+// Uniform grid over the map plane (x, z) hashed into a fixed number of buckets.
+// It is rebuilt from scratch every tick with a counting sort, so there are no
+// per-cell lists to maintain: after build() the agents of bucket b are
+// entries[cellStart[b] .. cellStart[b + 1]). Once the buffers have grown to the
+// agent count, rebuilding does not allocate.
+class SpatialHash
+{
+public:
+    float cellSize;
+    // bucketCount - 1, the bucket count is always a power of two
+    uint32_t bucketMask;
+
+    // index into the positions passed to build(), grouped by bucket
+    std::vector<uint32_t> entries;
+    // positions in the same order as entries, so queries read memory linearly
+    std::vector<glm::vec2> sortedPositions;
+    std::vector<uint32_t> cellStart;
+
+    SpatialHash(float cellSize, uint32_t bucketCount = 1 << 18, uint32_t rowStride = 512)
+        : cellSize(cellSize), rowStride(rowStride)
+    {
+        uint32_t buckets = 1;
+        while (buckets < bucketCount)
+            buckets <<= 1;
+        bucketMask = buckets - 1;
+        cellStart.resize(buckets + 1);
+        visitedStamp.resize(buckets);
+    }
+
+    // Cells of one grid row map to consecutive buckets, so the cells a query
+    // touches in a row form one contiguous range of entries. Rows further than
+    // bucketCount / rowStride apart share buckets.
+    uint32_t bucketOf(int cellX, int cellZ) const
+    {
+        return ((uint32_t)cellX + (uint32_t)cellZ * rowStride) & bucketMask;
+    }
+
+    int cellCoord(float x) const { return (int)glm::floor(x / cellSize); }
+
+    void build(const glm::vec3 *positions, size_t count)
+    {
+        entries.resize(count);
+        sortedPositions.resize(count);
+        bucket.resize(count);
+
+        // 1. count agents per bucket
+        std::fill(cellStart.begin(), cellStart.end(), 0);
+        for (size_t i = 0; i < count; i++)
+        {
+            bucket[i] = bucketOf(cellCoord(positions[i].x), cellCoord(positions[i].z));
+            cellStart[bucket[i] + 1]++;
+        }
+        // 2. prefix sum turns the counts into the first slot of every bucket
+        for (size_t b = 1; b < cellStart.size(); b++)
+            cellStart[b] += cellStart[b - 1];
+        // 3. scatter, using cellStart[b] as the insertion cursor of bucket b;
+        // afterwards it points at the end of the bucket, so shift it back by one
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t slot = cellStart[bucket[i]]++;
+            entries[slot] = (uint32_t)i;
+            sortedPositions[slot] = glm::vec2(positions[i].x, positions[i].z);
+        }
+        for (size_t b = cellStart.size() - 1; b > 0; b--)
+            cellStart[b] = cellStart[b - 1];
+        cellStart[0] = 0;
+    }
+
+    // calls f(sortedIndex) for every agent in the cells overlapping the square
+    // around p; callers still have to compare the actual distance. Radii
+    // spanning more than a row of buckets mark the buckets they visited in a
+    // buffer of the hash, those queries must not run on several threads at
+    // once.
+    template <typename F>
+    void forEachCandidate(glm::vec2 p, float radius, F f) const
+    {
+        int minX = cellCoord(p.x - radius), maxX = cellCoord(p.x + radius);
+        int minZ = cellCoord(p.y - radius), maxZ = cellCoord(p.y + radius);
+        uint32_t spanX = maxX - minX + 1, spanZ = maxZ - minZ + 1;
+
+        if (spanX <= rowStride && spanZ * rowStride <= bucketMask + 1)
+        {
+            // no two visited cells share a bucket, walk each row as one range
+            for (int z = minZ; z <= maxZ; z++)
+            {
+                uint32_t first = bucketOf(minX, z);
+                uint32_t last = first + spanX;
+                if (last > bucketMask + 1)
+                {
+                    // the row wraps around the end of the table
+                    for (uint32_t k = cellStart[first]; k < cellStart[bucketMask + 1]; k++)
+                        f(k);
+                    last -= bucketMask + 1;
+                    first = 0;
+                }
+                for (uint32_t k = cellStart[first]; k < cellStart[last]; k++)
+                    f(k);
+            }
+            return;
+        }
+
+        // very large radius, visit every touched bucket once
+        // a stamp per query instead of clearing the marks
+        if (++stamp == 0)
+        {
+            std::fill(visitedStamp.begin(), visitedStamp.end(), 0);
+            stamp = 1;
+        }
+        for (int z = minZ; z <= maxZ; z++)
+        {
+            for (int x = minX; x <= maxX; x++)
+            {
+                uint32_t b = bucketOf(x, z);
+                if (visitedStamp[b] == stamp)
+                    continue;
+                visitedStamp[b] = stamp;
+                for (uint32_t k = cellStart[b]; k < cellStart[b + 1]; k++)
+                    f(k);
+            }
+        }
+    }
+
+    // appends the indices (into the positions given to build()) of all agents
+    // within radius of p
+    void queryRadius(glm::vec2 p, float radius, std::vector<uint32_t> &result) const
+    {
+        float radius2 = radius * radius;
+        forEachCandidate(p, radius, [&](uint32_t k) {
+            glm::vec2 d = sortedPositions[k] - p;
+            if (glm::dot(d, d) <= radius2)
+                result.push_back(entries[k]);
+        });
+    }
+
+    // Pushes overlapping agents apart. Every agent is moved away from each
+    // neighbour closer than radius, proportionally to the overlap. Reads only
+    // the snapshot taken by build(), and ranges of buckets are spread over the
+    // job system when one is given.
+    //
+    // Each close pair is found once and pushes both agents (see
+    // separatePairs), half the distance tests of asking every agent for its
+    // neighbours. A hash with cells of half the radius wastes fewer tests on
+    // agents out of reach than one with cells of the full radius. The pairs of bucket b reach up to
+    // pairReach() buckets further, so the table is cut into an even number of
+    // bands at least that long: a band writes only into itself and the next
+    // one, and all even bands run at once, then all odd ones.
+    void separate(glm::vec3 *positions, float radius, float strength, JobSystem *jobs = nullptr)
+    {
+        displacement.assign(entries.size(), glm::vec2(0.0f));
+        uint32_t bucketCount = bucketMask + 1;
+        int cells = (int)glm::ceil(radius / cellSize);
+        // rows further apart than that share buckets, giant radii fall back
+        // to asking every agent
+        bool pairwise = 2 * cells + 1 <= (int)rowStride && 2 * (pairReach(cells) + 1) <= bucketCount;
+        if (!pairwise)
+        {
+            // its queries share the visited marks, see forEachCandidate
+            separateAgents(0, bucketCount, radius);
+        }
+        // not worth waking threads for a handful of agents
+        else if (!jobs || entries.size() < 4096)
+        {
+            separatePairs(0, bucketCount, radius, cells);
+        }
+        else
+        {
+            // a few bands per thread so that stealing can even out dense areas
+            uint32_t bands = 2;
+            while (bands < jobs->threadCount() * 8 && bucketCount / (bands * 2) > pairReach(cells))
+                bands *= 2;
+            uint32_t bandSize = bucketCount / bands;
+            for (uint32_t parity = 0; parity < 2; parity++)
+            {
+                jobs->parallelFor(0, bands / 2, 1, [&](size_t first, size_t last) {
+                    for (size_t k = first; k < last; k++)
+                    {
+                        uint32_t band = 2 * k + parity;
+                        separatePairs(band * bandSize, (band + 1) * bandSize, radius, cells);
+                    }
+                });
+            }
+        }
+
+        float scale = 0.5f * strength;
+        for (size_t k = 0; k < entries.size(); k++)
+        {
+            positions[entries[k]].x += displacement[k].x * scale;
+            positions[entries[k]].z += displacement[k].y * scale;
+        }
+    }
+
+private:
+    uint32_t rowStride;
+    std::vector<uint32_t> bucket;
+    std::vector<glm::vec2> displacement;
+    // bucket b was visited by the current large query when
+    // visitedStamp[b] == stamp
+    mutable std::vector<uint32_t> visitedStamp;
+    mutable uint32_t stamp = 0;
+
+    // push of sorted agent i away from sorted agent j, false when they are at
+    // least radius apart; the push of j away from i is the negation
+    bool pushAway(uint32_t i, uint32_t j, float radius, float radius2, glm::vec2 &push) const
+    {
+        glm::vec2 d = sortedPositions[i] - sortedPositions[j];
+        float dist2 = glm::dot(d, d);
+        if (dist2 >= radius2)
+            return false;
+        if (dist2 < 1e-12f)
+        {
+            // agents standing on the same spot (e.g. spawned on one marker) get
+            // pushed along a direction derived from their ids, which the other
+            // agent mirrors
+            float angle = (float)(std::min(entries[i], entries[j]) % 360) * 2.39996f;
+            d = glm::vec2(glm::cos(angle), glm::sin(angle));
+            if (entries[i] < entries[j])
+                d = -d;
+            push = d * radius;
+            return true;
+        }
+        float dist = glm::sqrt(dist2);
+        push = d * ((radius - dist) / dist);
+        return true;
+    }
+
+    // buckets past b that separatePairs() reads and writes for bucket b
+    uint32_t pairReach(int cells) const { return cells * rowStride + cells; }
+
+    // Pairs found from the buckets [firstBucket, lastBucket), for a radius of
+    // at most cells cells: within the bucket, with the next cells of its row
+    // and with the 2 * cells + 1 cells around it in each of the cells rows
+    // below. Every close pair lies in those, seen from exactly one of its two
+    // agents.
+    void separatePairs(uint32_t firstBucket, uint32_t lastBucket, float radius, int cells)
+    {
+        float radius2 = radius * radius;
+        for (uint32_t b = firstBucket; b < lastBucket; b++)
+        {
+            uint32_t begin = cellStart[b], end = cellStart[b + 1];
+            for (uint32_t i = begin; i < end; i++)
+            {
+                glm::vec2 push(0.0f), d;
+                auto visit = [&](uint32_t first, uint32_t last) {
+                    for (uint32_t j = first; j < last; j++)
+                    {
+                        if (pushAway(i, j, radius, radius2, d))
+                        {
+                            push += d;
+                            displacement[j] -= d;
+                        }
+                    }
+                };
+                visit(i + 1, end);
+                for (int row = 0; row <= cells; row++)
+                {
+                    // bucket ranges, split where they wrap around the table
+                    uint32_t first = row ? b + row * rowStride - cells : b + 1;
+                    uint32_t count = row ? 2 * cells + 1 : cells;
+                    first &= bucketMask;
+                    uint32_t last = first + count;
+                    if (last > bucketMask + 1)
+                    {
+                        visit(cellStart[first], cellStart[bucketMask + 1]);
+                        last -= bucketMask + 1;
+                        first = 0;
+                    }
+                    visit(cellStart[first], cellStart[last]);
+                }
+                displacement[i] += push;
+            }
+        }
+    }
+
+    // every agent of the buckets [firstBucket, lastBucket) against all its
+    // candidates, for radii too large for separatePairs
+    void separateAgents(uint32_t firstBucket, uint32_t lastBucket, float radius)
+    {
+        float radius2 = radius * radius;
+        for (uint32_t b = firstBucket; b < lastBucket; b++)
+        {
+            for (uint32_t i = cellStart[b]; i < cellStart[b + 1]; i++)
+            {
+                glm::vec2 push(0.0f), d;
+                forEachCandidate(sortedPositions[i], radius, [&](uint32_t j) {
+                    if (j != i && pushAway(i, j, radius, radius2, d))
+                        push += d;
+                });
+                displacement[i] = push;
+            }
+        }
+    }
+};
+
+#endif
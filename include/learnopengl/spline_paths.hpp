@@ -0,0 +1,170 @@
+#ifndef SPLINE_PATHS_HPP
+#define SPLINE_PATHS_HPP
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "marker.hpp"
+
+// Smooth curves for travelling along the marker graph, built once from the
+// markers. Moving from marker `from` to `to` follows the centripetal
+// Catmull-Rom segment through (prev, from, to, next), where prev is the marker
+// the agent came from and next is where it will go afterwards, so consecutive
+// segments share their tangent at the marker in between. One segment is
+// precomputed for every such combination; a missing prev/next is replaced by
+// extending the edge straight.
+//
+// Each segment stores its cubic coefficients and a table mapping uniformly
+// spaced arc lengths back to the curve parameter, so evaluating a position
+// from the distance travelled is one table lookup and one cubic.
+class SplinePaths
+{
+public:
+    // arc-length table intervals per segment
+    static const int LUT_SIZE = 16;
+
+    struct Segment
+    {
+        // position(t) = ((a * t + b) * t + c) * t + d, t in [0, 1]
+        glm::vec3 a, b, c, d;
+        float length;
+    };
+
+    std::vector<Segment> segments;
+    // LUT_SIZE + 1 curve parameters per segment, stored back to back
+    std::vector<float> arcToParam;
+
+    SplinePaths(const std::vector<Marker> &markers, float alpha = 0.5f) : markers(markers)
+    {
+        build(alpha);
+    }
+
+    // prev and next may be -1 when there is no marker before/after the edge
+    uint32_t segmentIndex(int prev, int from, int to, int next) const
+    {
+        size_t toCount = markers[to].neighbours.size();
+        uint32_t prevSlot = prev == -1 ? markers[from].neighbours.size() : neighbourSlot(from, prev);
+        uint32_t nextSlot = next == -1 ? toCount : neighbourSlot(to, next);
+        uint32_t edge = firstEdge[from] + neighbourSlot(from, to);
+        return edgeStart[edge] + prevSlot * (toCount + 1) + nextSlot;
+    }
+
+    glm::vec3 evaluate(uint32_t segment, float distance) const
+    {
+        const Segment &s = segments[segment];
+        float u = glm::clamp(distance / s.length, 0.0f, 1.0f) * LUT_SIZE;
+        int k = glm::min((int)u, LUT_SIZE - 1);
+        const float *lut = &arcToParam[segment * (LUT_SIZE + 1)];
+        float t = lut[k] + (lut[k + 1] - lut[k]) * (u - k);
+        return ((s.a * t + s.b) * t + s.c) * t + s.d;
+    }
+
+private:
+    const std::vector<Marker> &markers;
+    // outgoing edges of marker m are firstEdge[m] + neighbour slot
+    std::vector<uint32_t> firstEdge;
+    // first segment of every edge
+    std::vector<uint32_t> edgeStart;
+
+    uint32_t neighbourSlot(int markerIdx, int neighbourIdx) const
+    {
+        const std::vector<Marker> &neighbours = markers[markerIdx].neighbours;
+        for (uint32_t i = 0; i < neighbours.size(); i++)
+            if (neighbours[i].idx == neighbourIdx)
+                return i;
+        return neighbours.size();
+    }
+
+    void build(float alpha)
+    {
+        firstEdge.clear();
+        edgeStart.clear();
+        uint32_t count = 0;
+        for (size_t m = 0; m < markers.size(); m++)
+        {
+            firstEdge.push_back(edgeStart.size());
+            for (const Marker &to : markers[m].neighbours)
+            {
+                edgeStart.push_back(count);
+                count += (markers[m].neighbours.size() + 1) * (markers[to.idx].neighbours.size() + 1);
+            }
+        }
+        segments.resize(count);
+        arcToParam.resize(count * (LUT_SIZE + 1));
+
+        for (size_t m = 0; m < markers.size(); m++)
+        {
+            const std::vector<Marker> &fromNeighbours = markers[m].neighbours;
+            glm::vec3 p1 = markers[m].position;
+            for (size_t slot = 0; slot < fromNeighbours.size(); slot++)
+            {
+                const std::vector<Marker> &toNeighbours = markers[fromNeighbours[slot].idx].neighbours;
+                glm::vec3 p2 = fromNeighbours[slot].position;
+                uint32_t first = edgeStart[firstEdge[m] + slot];
+                for (size_t prev = 0; prev <= fromNeighbours.size(); prev++)
+                {
+                    glm::vec3 p0 = prev < fromNeighbours.size() ? markers[fromNeighbours[prev].idx].position
+                                                                : 2.0f * p1 - p2;
+                    for (size_t next = 0; next <= toNeighbours.size(); next++)
+                    {
+                        glm::vec3 p3 = next < toNeighbours.size() ? markers[toNeighbours[next].idx].position
+                                                                  : 2.0f * p2 - p1;
+                        buildSegment(first + prev * (toNeighbours.size() + 1) + next, p0, p1, p2, p3, alpha);
+                    }
+                }
+            }
+        }
+    }
+
+    static float knot(glm::vec3 a, glm::vec3 b, float alpha)
+    {
+        // coincident points (e.g. turning back to the previous marker) would
+        // give a zero interval
+        return glm::max(glm::pow(glm::length(b - a), alpha), 1e-4f);
+    }
+
+    void buildSegment(uint32_t index, glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float alpha)
+    {
+        // tangents of the centripetal Catmull-Rom segment, rescaled to t in [0, 1]
+        float t01 = knot(p0, p1, alpha), t12 = knot(p1, p2, alpha), t23 = knot(p2, p3, alpha);
+        glm::vec3 m1 = p2 - p1 + t12 * ((p1 - p0) / t01 - (p2 - p0) / (t01 + t12));
+        glm::vec3 m2 = p2 - p1 + t12 * ((p3 - p2) / t23 - (p3 - p1) / (t12 + t23));
+
+        Segment &s = segments[index];
+        s.a = 2.0f * (p1 - p2) + m1 + m2;
+        s.b = -3.0f * (p1 - p2) - m1 - m1 - m2;
+        s.c = m1;
+        s.d = p1;
+
+        // cumulative length at densely sampled parameters, then inverted at
+        // uniformly spaced lengths
+        const int samples = LUT_SIZE * 8;
+        float length[samples + 1];
+        length[0] = 0.0f;
+        glm::vec3 last = s.d;
+        for (int i = 1; i <= samples; i++)
+        {
+            float t = (float)i / samples;
+            glm::vec3 point = ((s.a * t + s.b) * t + s.c) * t + s.d;
+            length[i] = length[i - 1] + glm::length(point - last);
+            last = point;
+        }
+        s.length = glm::max(length[samples], 1e-6f);
+
+        float *lut = &arcToParam[index * (LUT_SIZE + 1)];
+        int i = 0;
+        for (int k = 0; k <= LUT_SIZE; k++)
+        {
+            float target = s.length * k / LUT_SIZE;
+            while (i < samples - 1 && length[i + 1] < target)
+                i++;
+            float span = length[i + 1] - length[i];
+            float f = span > 0.0f ? glm::clamp((target - length[i]) / span, 0.0f, 1.0f) : 0.0f;
+            lut[k] = (i + f) / samples;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef STREAM_BUFFER_HPP
+#define STREAM_BUFFER_HPP
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include "gl_extensions.hpp"
+#include "log.hpp"
+
+// Ring buffer for data written once per frame and read by the GPU in the
+// same frame: instance matrices, indirect draw commands and the like.
+// Re-specifying a buffer with glBufferData for that either stalls until the
+// GPU is done with the old contents or has the driver copy them aside.
+//
+// The buffer is split into FRAMES regions, one per frame in flight. A frame
+// hands out pieces of its region with allocate() and ends with a fence;
+// before a region is reused, beginFrame() waits on the fence of the frame
+// that used it last. That wait is where the CPU runs ahead of the GPU, so
+// waitMilliseconds shows how long a GPU bound frame stalled.
+//
+// With GLExtensions::bufferStorage the buffer is mapped once, persistent and
+// coherent, and allocate() returns a pointer straight into it. Without it
+// the data is staged in memory and commit() copies it with glBufferSubData
+// into a store orphaned at the start of every frame.
+//
+// Call commit() after writing and before the draws that read the data. A
+// frame needing more than frameSize bytes grows the buffer, which replaces
+// the buffer object, so read buffer after allocate(). The replaced object is
+// deleted and its name may come back from a later glGenBuffers: whatever
+// caches buffer, like the instance attachment of a VAO, compares generation
+// too.
+class StreamBuffer
+{
+public:
+    enum
+    {
+        FRAMES = 3
+    };
+
+    struct Allocation
+    {
+        // where to write size bytes, and where they are in buffer
+        void *data;
+        size_t offset;
+    };
+
+    unsigned int buffer = 0;
+    // counts the grow()s, from 1: 0 is left to buffers that are never
+    // replaced, whose names may be ones this deleted
+    unsigned int generation = 1;
+    // bytes of each frame's region
+    size_t frameSize;
+    const bool persistent;
+
+    // CPU time beginFrame() waited for the GPU, last frame and the most of
+    // the last second
+    float waitMilliseconds = 0.0f;
+    float maxWaitMilliseconds = 0.0f;
+
+    StreamBuffer(size_t frameSize = 1 << 20)
+        : frameSize(frameSize), persistent(glExtensions().bufferStorage)
+    {
+        create();
+    }
+
+    // waits until the region of this frame is no longer read by the GPU
+    void beginFrame()
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (fences[frame])
+        {
+            GLenum result = glClientWaitSync(fences[frame], 0, 0);
+            // flush once so the fence is sure to come, then wait for it
+            while (result == GL_TIMEOUT_EXPIRED)
+                result = glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            if (result == GL_WAIT_FAILED)
+                LOG_WARN("Waiting for the stream buffer fence failed");
+            glDeleteSync(fences[frame]);
+            fences[frame] = 0;
+        }
+        waitMilliseconds =
+            std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (start - maxWaitStart > std::chrono::seconds(1))
+        {
+            maxWaitStart = start;
+            maxWaitMilliseconds = 0.0f;
+        }
+        maxWaitMilliseconds = std::max(maxWaitMilliseconds, waitMilliseconds);
+
+        for (unsigned int old : retired)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, old);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glDeleteBuffers(1, &old);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        retired.clear();
+
+        used = 0;
+        committed = 0;
+        if (!persistent)
+        {
+            // a new store; the driver keeps the old one for the frames that
+            // still read it
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, frameSize, nullptr, GL_STREAM_DRAW);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+    }
+
+    // size bytes at a multiple of alignment; the pointer stays valid until
+    // the next allocate()
+    Allocation allocate(size_t size, size_t alignment = 16)
+    {
+        size_t start = (used + alignment - 1) / alignment * alignment;
+        if (start + size > frameSize)
+        {
+            grow(start + size);
+            start = (used + alignment - 1) / alignment * alignment;
+        }
+        used = start + size;
+        Allocation allocation;
+        allocation.offset = regionStart() + start;
+        allocation.data = persistent ? mapped + allocation.offset : staging.data() + start;
+        return allocation;
+    }
+
+    // makes everything allocated so far visible to the GPU
+    void commit()
+    {
+        if (persistent || committed == used)
+            return;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, committed, used - committed, staging.data() + committed);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        committed = used;
+    }
+
+    // fences the commands of this frame and moves on to the next region
+    void endFrame()
+    {
+        commit();
+        fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        frame = (frame + 1) % FRAMES;
+    }
+
+private:
+    GLsync fences[FRAMES] = {0};
+    unsigned int frame = 0;
+    size_t used = 0, committed = 0;
+    unsigned char *mapped = nullptr;
+    std::vector<unsigned char> staging;
+    std::chrono::steady_clock::time_point maxWaitStart;
+    // replaced by grow()
+    std::vector<unsigned int> retired;
+
+    size_t regionStart() const { return persistent ? frame * frameSize : 0; }
+
+    void create()
+    {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        if (persistent)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glExtensions().BufferStorage(GL_COPY_WRITE_BUFFER, FRAMES * frameSize, nullptr, flags);
+            mapped = (unsigned char *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, FRAMES * frameSize, flags);
+        }
+        else
+        {
+            glBufferData(GL_COPY_WRITE_BUFFER, frameSize, nullptr, GL_STREAM_DRAW);
+            staging.resize(frameSize);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    // room for needed bytes this frame
+    void grow(size_t needed)
+    {
+        size_t size = frameSize;
+        while (size < needed)
+            size *= 2;
+        LOG_INFO("Stream buffer grows to %zu KB per frame", size / 1024);
+        generation++;
+
+        if (!persistent)
+        {
+            // the same buffer object with a new store, draws recorded this
+            // frame read from it too: the next commit() uploads everything
+            // staged so far again
+            frameSize = size;
+            staging.resize(frameSize);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, frameSize, nullptr, GL_STREAM_DRAW);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            committed = 0;
+            return;
+        }
+
+        // draws recorded this frame may still refer to the old buffer, it is
+        // deleted when the next frame begins; GL keeps it alive until the
+        // draws reading it are done. The new one is not in use anywhere.
+        retired.push_back(buffer);
+        for (GLsync &fence : fences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+            fence = 0;
+        }
+        frame = 0;
+        used = 0;
+        frameSize = size;
+        create();
+    }
+};
+
+#endif
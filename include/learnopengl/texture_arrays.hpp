@@ -0,0 +1,182 @@
+#ifndef TEXTURE_ARRAYS_HPP
+#define TEXTURE_ARRAYS_HPP
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "log.hpp"
+#include "model.h"
+
+// Packs the material textures of models into 2D texture arrays, one array
+// per size and channel count, so that meshes of different models bind the
+// same texture and differ only in the layer uniforms (see Material). Sorted
+// by the render queue, they then follow each other without texture binds.
+//
+// An import step: add() the models after loading them, then build() once.
+// The textures are read back from the GPU, copied into the arrays and
+// deleted. A file used by several models (the same path) becomes one layer.
+// The shaders drawing packed models sample sampler2DArray uniforms, with a
+// float "<sampler>Layer" uniform next to each.
+class TextureArrays
+{
+public:
+    struct Group
+    {
+        int width, height, channels;
+        unsigned int texture = 0;
+        // textures in layer order, removed once copied
+        std::vector<unsigned int> sources;
+    };
+
+    std::vector<Group> groups;
+
+    void add(Model &model) { models.push_back(&model); }
+
+    void build()
+    {
+        // group and layer of every texture of the models, by file and by
+        // texture; the copies of a file loaded by other models are deleted
+        std::map<std::string, std::pair<unsigned int, int>> placedByPath;
+        std::map<unsigned int, std::pair<unsigned int, int>> placedById;
+        std::vector<unsigned int> duplicates;
+        for (Model *model : models)
+        {
+            for (Mesh &mesh : model->meshes)
+            {
+                for (Texture &texture : mesh.textures)
+                {
+                    if (texture.layer >= 0 || placedById.count(texture.id))
+                        continue;
+                    std::string path = model->directory + '/' + texture.path;
+                    auto found = placedByPath.find(path);
+                    if (found != placedByPath.end())
+                    {
+                        duplicates.push_back(texture.id);
+                        placedById[texture.id] = found->second;
+                        continue;
+                    }
+                    placedById[texture.id] = placedByPath[path] = place2D(texture.id);
+                }
+            }
+        }
+
+        unsigned int layers = 0;
+        for (Group &group : groups)
+        {
+            if (!group.texture)
+                upload(group);
+            layers += group.sources.size();
+        }
+
+        for (Model *model : models)
+        {
+            for (Mesh &mesh : model->meshes)
+            {
+                for (unsigned int i = 0; i < mesh.textures.size(); i++)
+                {
+                    Texture &texture = mesh.textures[i];
+                    if (texture.layer >= 0)
+                        continue;
+                    std::pair<unsigned int, int> place = placedById[texture.id];
+                    texture.id = groups[place.first].texture;
+                    texture.layer = place.second;
+                    if (i < mesh.material.textureCount)
+                        mesh.material.useTextureArray(i, texture.id, texture.layer);
+                }
+            }
+            for (Texture &texture : model->textures_loaded)
+            {
+                auto found = placedById.find(texture.id);
+                if (texture.layer >= 0 || found == placedById.end())
+                    continue;
+                texture.id = groups[found->second.first].texture;
+                texture.layer = found->second.second;
+            }
+        }
+
+        for (Group &group : groups)
+        {
+            glDeleteTextures(group.sources.size(), group.sources.data());
+            group.sources.clear();
+        }
+        glDeleteTextures(duplicates.size(), duplicates.data());
+        models.clear();
+        LOG_INFO("Packed %u textures into %zu texture arrays", layers, groups.size());
+    }
+
+private:
+    std::vector<Model *> models;
+
+    // group and layer for the 2D texture id
+    std::pair<unsigned int, int> place2D(unsigned int id)
+    {
+        int width, height, green, alpha;
+        glBindTexture(GL_TEXTURE_2D, id);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_GREEN_SIZE, &green);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_ALPHA_SIZE, &alpha);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        int channels = alpha ? 4 : green ? 3 : 1;
+        // a texture whose file failed to load has no image, it becomes a
+        // black layer
+        width = std::max(width, 1);
+        height = std::max(height, 1);
+
+        unsigned int index = 0;
+        while (index < groups.size() && (groups[index].width != width || groups[index].height != height ||
+                                         groups[index].channels != channels || groups[index].texture))
+            index++;
+        if (index == groups.size())
+        {
+            Group group;
+            group.width = width;
+            group.height = height;
+            group.channels = channels;
+            groups.push_back(group);
+        }
+        groups[index].sources.push_back(id);
+        return std::make_pair(index, (int)groups[index].sources.size() - 1);
+    }
+
+    void upload(Group &group)
+    {
+        const GLenum formats[] = {GL_RED, GL_RED, GL_RGB, GL_RGB, GL_RGBA};
+        const GLenum internalFormats[] = {GL_R8, GL_R8, GL_RGB8, GL_RGB8, GL_RGBA8};
+        GLenum format = formats[group.channels];
+
+        glGenTextures(1, &group.texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, group.texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormats[group.channels], group.width, group.height,
+                     group.sources.size(), 0, format, GL_UNSIGNED_BYTE, nullptr);
+        // rows of odd widths are not padded
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        std::vector<unsigned char> pixels((size_t)group.width * group.height * group.channels);
+        for (unsigned int layer = 0; layer < group.sources.size(); layer++)
+        {
+            glBindTexture(GL_TEXTURE_2D, group.sources[layer]);
+            glGetTexImage(GL_TEXTURE_2D, 0, format, GL_UNSIGNED_BYTE, pixels.data());
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, group.width, group.height, 1, format,
+                            GL_UNSIGNED_BYTE, pixels.data());
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        // the sampling of TextureFromFile
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef TIMING_WHEEL_HPP
+#define TIMING_WHEEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timing wheel keyed by small integer ids (e.g. agent indices).
+// Every level has 64 slots; a slot of level L spans 64^L ticks. Timers far in
+// the future sit in a coarse level and are moved ("cascaded") one level down
+// whenever the finer level wraps around, so scheduling and expiring a timer
+// are O(1) regardless of how many are pending. Each id can be pending at most
+// once, the lists are linked through per-id arrays so nothing is allocated
+// after construction.
+class TimingWheel
+{
+public:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const uint32_t SLOTS = 1 << SLOT_BITS;
+
+    uint64_t now = 0;
+
+    TimingWheel(size_t capacity = 0)
+    {
+        for (int l = 0; l < LEVELS; l++)
+            for (uint32_t s = 0; s < SLOTS; s++)
+                heads[l][s] = NIL;
+        resize(capacity);
+    }
+
+    void resize(size_t capacity)
+    {
+        next.resize(capacity, NIL);
+        expiry.resize(capacity, 0);
+    }
+
+    size_t size() const { return pending; }
+
+    // fires id during the first advance() reaching tick; ticks that already
+    // passed fire on the next tick
+    void schedule(uint32_t id, uint64_t tick)
+    {
+        expiry[id] = tick > now ? tick : now + 1;
+        insert(id);
+        pending++;
+    }
+
+    // moves time forward to tick, calling onExpire(id) for every timer that
+    // expires on the way, in tick order. onExpire may schedule new timers.
+    template <typename F>
+    void advance(uint64_t tick, F onExpire)
+    {
+        while (now < tick)
+        {
+            if (pending == 0)
+            {
+                now = tick;
+                return;
+            }
+            now++;
+            // when the finer levels wrap, the next slot of level l is due
+            for (int l = 1; l < LEVELS; l++)
+            {
+                if ((now & ((1ull << (l * SLOT_BITS)) - 1)) != 0)
+                    break;
+                cascade(l, (now >> (l * SLOT_BITS)) & (SLOTS - 1));
+            }
+
+            uint32_t &head = heads[0][now & (SLOTS - 1)];
+            uint32_t id = head;
+            head = NIL;
+            while (id != NIL)
+            {
+                uint32_t following = next[id];
+                pending--;
+                onExpire(id);
+                id = following;
+            }
+        }
+    }
+
+private:
+    enum : uint32_t { NIL = 0xffffffffu };
+
+    uint32_t heads[LEVELS][SLOTS];
+    std::vector<uint32_t> next;
+    std::vector<uint64_t> expiry;
+    size_t pending = 0;
+
+    void insert(uint32_t id)
+    {
+        uint64_t delta = expiry[id] - now;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (1ull << ((level + 1) * SLOT_BITS)))
+            level++;
+
+        uint64_t tick = expiry[id];
+        // beyond the range of the top level, park it in the furthest slot; it
+        // is re-inserted from there once that slot comes around
+        if (delta >= (1ull << (LEVELS * SLOT_BITS)))
+            tick = now + (1ull << (LEVELS * SLOT_BITS)) - 1;
+
+        uint32_t &head = heads[level][(tick >> (level * SLOT_BITS)) & (SLOTS - 1)];
+        next[id] = head;
+        head = id;
+    }
+
+    void cascade(int level, uint64_t slot)
+    {
+        uint32_t id = heads[level][slot];
+        heads[level][slot] = NIL;
+        while (id != NIL)
+        {
+            uint32_t following = next[id];
+            insert(id);
+            id = following;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef VERTEX_FORMAT_HPP
+#define VERTEX_FORMAT_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Vertex as loaded, full floats. Meshes keep these on the CPU and upload them
+// packed, see VertexFormat.
+struct Vertex {
+    // position
+    glm::vec3 Position;
+    // normal
+    glm::vec3 Normal;
+    // texCoords
+    glm::vec2 TexCoords;
+    // tangent
+    glm::vec3 Tangent;
+    // bitangent
+    glm::vec3 Bitangent;
+};
+
+// attributes a packed vertex carries besides position and normal
+enum VertexAttributes
+{
+    VERTEX_TEXCOORDS = 1,
+    // texture coordinates too large for half floats
+    VERTEX_FLOAT_TEXCOORDS = 2,
+    VERTEX_TANGENT = 4,
+    VERTEX_ATTRIBUTE_COMBINATIONS = 8
+};
+
+// float to IEEE half, rounding to nearest even; overflows become infinity
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent >= 31)
+        return sign | 0x7c00;
+    if (exponent <= 0)
+    {
+        // subnormal half, or zero
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        uint32_t shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return sign | half;
+    }
+    uint32_t half = sign | (uint32_t)exponent << 10 | mantissa >> 13;
+    uint32_t rest = mantissa & 0x1fff;
+    // a carry out of the mantissa correctly bumps the exponent
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return half;
+}
+
+// unit vector mapped to the octahedron and unfolded onto [-1, 1]^2; decoded
+// by octDecode in the vertex shaders
+inline glm::vec2 octEncode(glm::vec3 n)
+{
+    float length = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    if (!(length > 0.0f))
+        return glm::vec2(0.0f, 0.0f);
+    n /= length;
+    glm::vec2 p(n.x, n.y);
+    if (n.z < 0.0f)
+        p = glm::vec2((1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                      (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    return p;
+}
+
+// v in [-1, 1] as a signed normalized integer of the given bits, in the low
+// bits of the result
+inline uint32_t packSnorm(float v, unsigned int bits)
+{
+    float scale = (float)((1 << (bits - 1)) - 1);
+    int value = (int)std::lround(glm::clamp(v, -1.0f, 1.0f) * scale);
+    return (uint32_t)value & ((1u << bits) - 1);
+}
+
+// Layout of a packed vertex on the GPU:
+//
+//   location 0  position                 3 x float
+//   location 1  octahedral normal        2 x snorm16
+//   location 2  texture coordinates      2 x half (or float), if present
+//   location 3  octahedral tangent,      10:10:10:2 snorm, if present
+//               bitangent sign in w
+//
+// 16 to 28 bytes instead of the 56 of Vertex. Missing attributes are left
+// disabled, so the shaders read their defaults, (0, 0) texture coordinates
+// and a (0, 0, 0, 1) tangent. The shaders rebuild the bitangent as
+// cross(normal, tangent) * sign.
+struct VertexFormat
+{
+    unsigned int attributes;
+    unsigned int stride;
+    unsigned int texCoordsOffset;
+    unsigned int tangentOffset;
+
+    explicit VertexFormat(unsigned int attributes) : attributes(attributes)
+    {
+        stride = 3 * sizeof(float) + sizeof(uint32_t);
+        texCoordsOffset = stride;
+        if (attributes & VERTEX_TEXCOORDS)
+            stride += attributes & VERTEX_FLOAT_TEXCOORDS ? 2 * sizeof(float) : sizeof(uint32_t);
+        tangentOffset = stride;
+        if (attributes & VERTEX_TANGENT)
+            stride += sizeof(uint32_t);
+    }
+
+    // attributes to store for vertices, given the ones the source provides.
+    // Texture coordinates that are all zero (exporters write those for
+    // untextured meshes) are what the shader reads anyway when they are left
+    // out. Half floats keep at least 1/512 precision below 4, anything larger
+    // keeps full floats.
+    static unsigned int choose(const std::vector<Vertex> &vertices, unsigned int available)
+    {
+        unsigned int attributes = available & (VERTEX_TEXCOORDS | VERTEX_TANGENT);
+        if (attributes & VERTEX_TEXCOORDS)
+        {
+            float largest = 0.0f;
+            for (const Vertex &vertex : vertices)
+                largest = glm::max(largest, glm::max(std::fabs(vertex.TexCoords.x), std::fabs(vertex.TexCoords.y)));
+            if (largest == 0.0f)
+                attributes &= ~(VERTEX_TEXCOORDS | VERTEX_TANGENT);
+            else if (largest > 4.0f)
+                attributes |= VERTEX_FLOAT_TEXCOORDS;
+        }
+        return attributes;
+    }
+
+    // vertex attribute pointers for the vertex buffer bound to GL_ARRAY_BUFFER
+    void setupAttributes() const
+    {
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void *)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void *)(3 * sizeof(float)));
+        if (attributes & VERTEX_TEXCOORDS)
+        {
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, attributes & VERTEX_FLOAT_TEXCOORDS ? GL_FLOAT : GL_HALF_FLOAT, GL_FALSE,
+                                  stride, (void *)(uintptr_t)texCoordsOffset);
+        }
+        if (attributes & VERTEX_TANGENT)
+        {
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void *)(uintptr_t)tangentOffset);
+        }
+    }
+
+    // vertices packed one after the other, stride bytes each
+    std::vector<unsigned char> pack(const std::vector<Vertex> &vertices) const
+    {
+        std::vector<unsigned char> packed(vertices.size() * stride);
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            const Vertex &vertex = vertices[i];
+            unsigned char *out = packed.data() + i * stride;
+            std::memcpy(out, &vertex.Position, 3 * sizeof(float));
+
+            glm::vec2 normal = octEncode(vertex.Normal);
+            uint32_t word = packSnorm(normal.x, 16) | packSnorm(normal.y, 16) << 16;
+            std::memcpy(out + 3 * sizeof(float), &word, sizeof(word));
+
+            if (attributes & VERTEX_FLOAT_TEXCOORDS)
+            {
+                std::memcpy(out + texCoordsOffset, &vertex.TexCoords, 2 * sizeof(float));
+            }
+            else if (attributes & VERTEX_TEXCOORDS)
+            {
+                word = floatToHalf(vertex.TexCoords.x) | (uint32_t)floatToHalf(vertex.TexCoords.y) << 16;
+                std::memcpy(out + texCoordsOffset, &word, sizeof(word));
+            }
+
+            if (attributes & VERTEX_TANGENT)
+            {
+                glm::vec2 tangent = octEncode(vertex.Tangent);
+                // handedness of the tangent frame, -1 for mirrored texture
+                // coordinates
+                bool mirrored = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f;
+                word = packSnorm(tangent.x, 10) | packSnorm(tangent.y, 10) << 10 |
+                       packSnorm(mirrored ? -1.0f : 1.0f, 2) << 30;
+                std::memcpy(out + tangentOffset, &word, sizeof(word));
+            }
+        }
+        return packed;
+    }
+};
+
+#endif
@@ -2,6 +2,7 @@
 out vec4 FragColor;
 
 in vec2 TexCoords;
+in vec4 Tint;
 
 // texture sampler
 uniform sampler2D texture1;
@@ -11,5 +12,5 @@ void main()
 	vec4 texColor = texture(texture1, TexCoords);
     if(texColor.a < 0.1)
         discard;
-    FragColor = texColor;
+    FragColor = texColor * Tint;
 }
\ No newline at end of file
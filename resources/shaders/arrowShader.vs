@@ -1,15 +1,22 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoords;
+layout (location = 5) in mat4 aInstanceModel;
+layout (location = 9) in vec4 aTint;
 
 out vec2 TexCoords;
+out vec4 Tint;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform FrameData
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
 
 void main()
 {
     TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    Tint = aTint;
+    gl_Position = projection * view * aInstanceModel * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,20 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 5) in mat4 aInstanceModel;
+
+layout (std140) uniform FrameData
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+// the opaque pass tests for equal depth, so the position has to come out
+// bit for bit the same as in instancedModelShader.vs
+invariant gl_Position;
+
+void main()
+{
+    vec3 FragPos = vec3(aInstanceModel * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
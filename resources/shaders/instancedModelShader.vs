@@ -0,0 +1,36 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+// octahedral encoded, see VertexFormat
+layout (location = 1) in vec2 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 5) in mat4 aInstanceModel;
+
+out vec2 TexCoords;
+out vec3 Normal;
+out vec3 FragPos;
+
+layout (std140) uniform FrameData
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+// must match the depth prepass (instancedDepthShader.vs) exactly
+invariant gl_Position;
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+void main()
+{
+    FragPos = vec3(aInstanceModel * vec4(aPos, 1.0));
+    Normal = octDecode(aNormal);
+    TexCoords = aTexCoords;    
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
\ No newline at end of file
@@ -10,33 +10,113 @@ struct DirLight {
     vec3 specular;
 };
 
+// members are ordered so that the floats fill the std140 padding after each vec3
 struct PointLight {
     vec3 position;
-    
     float constant;
-    float linear;
-    float quadratic;
-	
     vec3 ambient;
+    float linear;
     vec3 diffuse;
+    float quadratic;
     vec3 specular;
+    // range of its shadow map, 0 without shadows
+    float shadowFarPlane;
 };
 
+struct SpotLight {
+    vec3 position;
+    float cutOff;
+    vec3 direction;
+    float outerCutOff;
+    vec3 ambient;
+    float constant;
+    vec3 diffuse;
+    float linear;
+    float quadratic;
+};
 
+layout (std140) uniform Lights
+{
+    DirLight dirLight;
+    DirLight mapDirLight;
+    PointLight pointLight;
+    SpotLight spotLight;
+    // directional light shadows, see ShadowCascades
+    mat4 cascadeMatrices[3];
+    // view depth where each cascade ends, w is 1 when shadows are on
+    vec4 cascadeSplits;
+    // clustered lights: tiles in x and y, depth slices, light count in w
+    ivec4 clusterGrid;
+    // tiles per pixel in xy, slice = log(view depth) * z + w
+    vec4 clusterScale;
+};
 
+layout (std140) uniform FrameData
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
 
-uniform sampler2D texture_diffuse1;
-uniform sampler2D texture_specular1;
+// the materials are packed into texture arrays, see TextureArrays
+uniform sampler2DArray texture_diffuse1;
+uniform float texture_diffuse1Layer;
+uniform sampler2DArray texture_specular1;
+uniform float texture_specular1Layer;
 uniform float shininess;
+uniform sampler2DArrayShadow shadowMap;
+// distance from the point light to its nearest caster / shadowFarPlane
+uniform samplerCubeShadow depthMap;
+// clustered lights, see ClusteredLights
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterIndices;
 
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
 
-uniform DirLight dirLight;
-uniform PointLight pointLight;
+vec4 diffuseTexel()
+{
+    return texture(texture_diffuse1, vec3(TexCoords, texture_diffuse1Layer));
+}
+
+vec4 specularTexel()
+{
+    return texture(texture_specular1, vec3(TexCoords, texture_specular1Layer));
+}
+
+// fraction of the directional light reaching fragPos, 3x3 PCF on the
+// cascade covering it
+float CalcShadow(vec3 fragPos, vec3 normal, vec3 lightDir)
+{
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    if (cascadeSplits.w == 0.0 || depth >= cascadeSplits.z)
+        return 1.0;
+    int cascade = depth < cascadeSplits.x ? 0 : (depth < cascadeSplits.y ? 1 : 2);
+    vec4 lightSpacePos = cascadeMatrices[cascade] * vec4(fragPos, 1.0);
+    vec3 coords = lightSpacePos.xyz * 0.5 + 0.5;
+    // more bias where the light grazes the surface
+    float bias = max(0.002 * (1.0 - dot(normal, lightDir)), 0.0005);
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++)
+        for (int y = -1; y <= 1; y++)
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texel, cascade, coords.z - bias));
+    return lit / 9.0;
+}
 
-uniform vec3 viewPosition;
+// fraction of the point light reaching fragPos
+float CalcPointShadow(PointLight light, vec3 normal, vec3 fragPos)
+{
+    vec3 fromLight = fragPos - light.position;
+    float distance = length(fromLight);
+    if (light.shadowFarPlane == 0.0 || distance >= light.shadowFarPlane)
+        return 1.0;
+    // more bias where the light grazes the surface
+    float bias = 0.02 + 0.05 * (1.0 - max(dot(normal, -fromLight / distance), 0.0));
+    return texture(depthMap, vec4(fromLight, (distance - bias) / light.shadowFarPlane));
+}
 
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 {
@@ -50,16 +130,49 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(texture_specular1, TexCoords));
+    vec3 ambient = light.ambient * vec3(diffuseTexel());
+    vec3 diffuse = light.diffuse * diff * vec3(diffuseTexel());
+    vec3 specular = light.specular * spec * vec3(specularTexel());
+    float shadow = CalcPointShadow(light, normal, fragPos);
     ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
+    diffuse *= attenuation * shadow;
+    specular *= attenuation * shadow;
     return (ambient + diffuse + specular);
 }
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+// the lights of the fragment's cluster
+vec3 CalcClusterLights(vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    if (clusterGrid.w == 0)
+        return vec3(0.0);
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    ivec3 cell = ivec3(gl_FragCoord.xy * clusterScale.xy, log(max(depth, 1e-4)) * clusterScale.z + clusterScale.w);
+    cell = clamp(cell, ivec3(0), clusterGrid.xyz - 1);
+    int cluster = (cell.z * clusterGrid.y + cell.y) * clusterGrid.x + cell.x;
+    uvec2 range = texelFetch(clusterRanges, cluster).xy;
+
+    vec3 albedo = vec3(diffuseTexel());
+    vec3 specularColor = vec3(specularTexel());
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; i++)
+    {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).x);
+        vec4 positionRadius = texelFetch(clusterLights, 2 * light);
+        vec3 color = texelFetch(clusterLights, 2 * light + 1).rgb;
+        vec3 toLight = positionRadius.xyz - fragPos;
+        float distance = length(toLight);
+        // falls smoothly to zero at the radius
+        float falloff = clamp(1.0 - distance * distance / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+        falloff *= falloff;
+        vec3 lightDir = toLight / max(distance, 1e-4);
+        float diff = max(dot(normal, lightDir), 0.0);
+        float spec = pow(max(dot(normal, normalize(lightDir + viewDir)), 0.0), shininess);
+        result += color * falloff * (diff * albedo + spec * specularColor);
+    }
+    return result;
+}
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow)
 {
     vec3 lightDir = normalize(-light.direction);
     // diffuse shading
@@ -68,22 +181,24 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     vec3 halfwayDir = normalize(lightDir + viewDir);  
     float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(texture_specular1, TexCoords));
-    return (ambient + diffuse + specular );
+    vec3 ambient = light.ambient * vec3(diffuseTexel());
+    vec3 diffuse = light.diffuse * diff * vec3(diffuseTexel());
+    vec3 specular = light.specular * spec * vec3(specularTexel());
+    return (ambient + (diffuse + specular) * shadow);
 }
 
 void main()
 {
-    vec4 texColor = texture(texture_diffuse1, TexCoords);
+    vec4 texColor = diffuseTexel();
     if(abs(texColor.a - 0.9) < 0.1){
         discard;
     }else{
         vec3 normal = normalize(Normal);
-        vec3 viewDir = normalize(viewPosition - FragPos);
-        vec3 result = CalcDirLight(dirLight, normal, viewDir);
+        vec3 viewDir = normalize(viewPos - FragPos);
+        float shadow = CalcShadow(FragPos, normal, normalize(-dirLight.direction));
+        vec3 result = CalcDirLight(dirLight, normal, viewDir, shadow);
         result += CalcPointLight(pointLight, normal, FragPos, viewDir);   
+        result += CalcClusterLights(normal, FragPos, viewDir);
         FragColor = vec4(result, 1.0);
     }
     
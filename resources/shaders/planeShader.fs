@@ -6,38 +6,124 @@ struct DirLight {
 	
     vec3 ambient;
     vec3 diffuse;
+    vec3 specular;
+};
+
+// members are ordered so that the floats fill the std140 padding after each vec3
+struct PointLight {
+    vec3 position;
+    float constant;
+    vec3 ambient;
+    float linear;
+    vec3 diffuse;
+    float quadratic;
+    vec3 specular;
+    // range of its shadow map, 0 without shadows
+    float shadowFarPlane;
 };
 
 struct SpotLight {
     vec3 position;
-    vec3 direction;
     float cutOff;
+    vec3 direction;
     float outerCutOff;
-  
+    vec3 ambient;
     float constant;
+    vec3 diffuse;
     float linear;
     float quadratic;
-  
-    vec3 ambient;
-    vec3 diffuse;     
+};
+
+layout (std140) uniform Lights
+{
+    DirLight dirLight;
+    DirLight mapDirLight;
+    PointLight pointLight;
+    SpotLight spotLight;
+    // directional light shadows, see ShadowCascades
+    mat4 cascadeMatrices[3];
+    // view depth where each cascade ends, w is 1 when shadows are on
+    vec4 cascadeSplits;
+    // clustered lights: tiles in x and y, depth slices, light count in w
+    ivec4 clusterGrid;
+    // tiles per pixel in xy, slice = log(view depth) * z + w
+    vec4 clusterScale;
+};
+
+layout (std140) uniform FrameData
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
 };
 
 uniform sampler2D texture_diffuse1;
 
 uniform samplerCube depthMap;
+uniform sampler2DArrayShadow shadowMap;
+// clustered lights, see ClusteredLights
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterIndices;
 
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
 
-uniform vec3 viewPos;
-uniform DirLight dirLight;
-uniform SpotLight spotLight;
-
 uniform vec3 lightPos;
 
+// fraction of the directional light reaching fragPos, 3x3 PCF on the
+// cascade covering it
+float CalcShadow(vec3 fragPos, vec3 normal, vec3 lightDir)
+{
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    if (cascadeSplits.w == 0.0 || depth >= cascadeSplits.z)
+        return 1.0;
+    int cascade = depth < cascadeSplits.x ? 0 : (depth < cascadeSplits.y ? 1 : 2);
+    vec4 lightSpacePos = cascadeMatrices[cascade] * vec4(fragPos, 1.0);
+    vec3 coords = lightSpacePos.xyz * 0.5 + 0.5;
+    // more bias where the light grazes the surface
+    float bias = max(0.002 * (1.0 - dot(normal, lightDir)), 0.0005);
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++)
+        for (int y = -1; y <= 1; y++)
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texel, cascade, coords.z - bias));
+    return lit / 9.0;
+}
+
+// the lights of the fragment's cluster
+vec3 CalcClusterLights(vec3 normal, vec3 fragPos)
+{
+    if (clusterGrid.w == 0)
+        return vec3(0.0);
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    ivec3 cell = ivec3(gl_FragCoord.xy * clusterScale.xy, log(max(depth, 1e-4)) * clusterScale.z + clusterScale.w);
+    cell = clamp(cell, ivec3(0), clusterGrid.xyz - 1);
+    int cluster = (cell.z * clusterGrid.y + cell.y) * clusterGrid.x + cell.x;
+    uvec2 range = texelFetch(clusterRanges, cluster).xy;
+
+    vec3 albedo = vec3(texture(texture_diffuse1, TexCoords));
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; i++)
+    {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).x);
+        vec4 positionRadius = texelFetch(clusterLights, 2 * light);
+        vec3 color = texelFetch(clusterLights, 2 * light + 1).rgb;
+        vec3 toLight = positionRadius.xyz - fragPos;
+        float distance = length(toLight);
+        // falls smoothly to zero at the radius
+        float falloff = clamp(1.0 - distance * distance / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+        falloff *= falloff;
+        vec3 lightDir = toLight / max(distance, 1e-4);
+        float diff = max(dot(normal, lightDir), 0.0);
+        result += color * falloff * diff * albedo;
+    }
+    return result;
+}
+
 // function prototypes
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 
 void main()
@@ -47,17 +133,21 @@ void main()
     vec3 viewDir = normalize(viewPos - FragPos);
     
     //directional lighting
-    vec3 result = CalcDirLight(dirLight, norm, viewDir);
+    float shadow = CalcShadow(FragPos, norm, normalize(-mapDirLight.direction));
+    vec3 result = CalcDirLight(mapDirLight, norm, viewDir, shadow);
  
     //spot light
     result += CalcSpotLight(spotLight, norm, FragPos, viewDir);    
+
+    // marker lights and the like
+    result += CalcClusterLights(norm, FragPos);
     
     FragColor = vec4(result, 1.0);
    
 }
 
 // calculates the color when using a directional light.
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow)
 {
     vec3 lightDir = normalize(-light.direction);
     // diffuse shading
@@ -66,7 +156,7 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     // combine results
     vec3 ambient = light.ambient * vec3(texture(texture_diffuse1, TexCoords));
     vec3 diffuse = light.diffuse * diff * vec3(texture(texture_diffuse1, TexCoords));
-    return (ambient + diffuse);
+    return (ambient + diffuse * shadow);
 }
 
 // calculates the color when using a spot light.
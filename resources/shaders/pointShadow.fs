@@ -0,0 +1,12 @@
+#version 330 core
+in vec3 FragPos;
+
+uniform vec3 lightPos;
+uniform float farPlane;
+
+// distance to the light instead of the projected depth, so that the
+// receivers can compare against it in any direction
+void main()
+{
+    gl_FragDepth = length(FragPos - lightPos) / farPlane;
+}
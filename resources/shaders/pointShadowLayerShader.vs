@@ -0,0 +1,21 @@
+#version 330 core
+// either one makes gl_Layer writable here, see GLExtensions::vertexShaderLayer
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_layer : enable
+layout (location = 0) in vec3 aPos;
+// the cube face to draw into is stored in [0][3], see PointShadowMap
+layout (location = 5) in mat4 aInstanceModel;
+
+uniform mat4 shadowMatrices[6];
+
+out vec3 FragPos;
+
+void main()
+{
+    mat4 model = aInstanceModel;
+    int face = int(model[0][3]);
+    model[0][3] = 0.0;
+    FragPos = vec3(model * vec4(aPos, 1.0));
+    gl_Layer = face;
+    gl_Position = shadowMatrices[face] * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,22 @@
+#version 330 core
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+flat in int Face[];
+
+uniform mat4 shadowMatrices[6];
+
+out vec3 FragPos;
+
+// passes each triangle on to the face its instance was made for
+void main()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        gl_Layer = Face[0];
+        FragPos = gl_in[i].gl_Position.xyz;
+        gl_Position = shadowMatrices[Face[0]] * gl_in[i].gl_Position;
+        EmitVertex();
+    }
+    EndPrimitive();
+}
@@ -0,0 +1,15 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+// the cube face to draw into is stored in [0][3], see PointShadowMap
+layout (location = 5) in mat4 aInstanceModel;
+
+flat out int Face;
+
+// world space position, projected by pointShadowShader.gs
+void main()
+{
+    mat4 model = aInstanceModel;
+    Face = int(model[0][3]);
+    model[0][3] = 0.0;
+    gl_Position = model * vec4(aPos, 1.0);
+}
@@ -13,10 +13,36 @@
 #include <learnopengl/shader.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
+#include <learnopengl/model_instances.hpp>
+#include <learnopengl/texture_arrays.hpp>
+#include <learnopengl/frame_uniforms.hpp>
+#include <learnopengl/gl_extensions.hpp>
+#include <learnopengl/render_queue.hpp>
+#include <learnopengl/stream_buffer.hpp>
+#include <learnopengl/frame_profiler.hpp>
+#include <learnopengl/dynamic_resolution.hpp>
+#include <learnopengl/headless_context.hpp>
+#include <learnopengl/png_writer.hpp>
+#include <learnopengl/shadow_cascades.hpp>
+#include <learnopengl/point_shadow_map.hpp>
+#include <learnopengl/clustered_lights.hpp>
+#include <learnopengl/log.hpp>
 
 #include <learnopengl/player.hpp>
-
+#include <learnopengl/direction_arrows.hpp>
+#include <learnopengl/agents.hpp>
+#include <learnopengl/spatial_hash.hpp>
+#include <learnopengl/agent_scheduler.hpp>
+#include <learnopengl/job_system.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <random>
+#include <thread>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
@@ -24,20 +50,86 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window, Player &p, std::vector<Marker>);
 unsigned int loadTexture(const char *path);
 
-unsigned int loadCubemap(std::vector<std::string> faces);
+unsigned int loadCubemap(std::vector<std::string> faces, JobSystem &jobs);
 
+// directional light shadows, toggled with SPACE
 bool shadows = true;
 bool shadowsKeyPressed = false;
+// toggled with P to compare frame times with and without the depth prepass
+bool depthPrepass = true;
+bool depthPrepassKeyPressed = false;
+// L cycles through the light counts of the clustered lighting benchmark,
+// index 0 is the scene's own lights
+const unsigned int BENCHMARK_LIGHT_COUNTS[] = {0, 1, 64, 1024};
+unsigned int benchmarkLights = 0;
+bool benchmarkLightsKeyPressed = false;
+// O shows the frame timing overlay, T writes its history to TIMINGS_FILE
+bool timingOverlay = true;
+bool timingOverlayKeyPressed = false;
+bool exportTimings = false;
+bool exportTimingsKeyPressed = false;
+const char *const TIMINGS_FILE = "frame_timings.csv";
+// R switches dynamic resolution off and on
+bool dynamicResolution = true;
+bool dynamicResolutionKeyPressed = false;
+
+// benchmark mode (--headless FRAMES): FRAMES frames along a scripted camera
+// path without a window, frame time statistics go to BENCHMARK_FILE and the
+// frames listed with --dump (comma separated) to frame_<n>.png
+unsigned int headlessFrames = 0;
+std::vector<unsigned int> dumpFrames;
+const char *const BENCHMARK_FILE = "benchmark.txt";
+// simulated time per benchmark frame, so every run sees the same scene
+const float BENCHMARK_FRAME_TIME = 1.0f / 60.0f;
+// frames at the start left out of the statistics (first uses of shaders
+// and buffers)
+const unsigned int BENCHMARK_WARMUP_FRAMES = 10;
+// --bench-jobs: measures the scheduler overhead of the job system, without
+// a window or GL, and writes it to JOBS_BENCHMARK_FILE
+bool benchmarkJobs = false;
+const char *const JOBS_BENCHMARK_FILE = "jobs_benchmark.txt";
 
 // settings
 const unsigned int SCR_WIDTH = 1200;
 const unsigned int SCR_HEIGHT = 800;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+// texture unit of the directional light's shadow map, above the material
+// textures
+const int SHADOW_MAP_UNIT = 15;
+// and of the point light's
+const int POINT_SHADOW_MAP_UNIT = 14;
+// largest face of the point light's shadow cube map, in texels
+const unsigned int POINT_SHADOW_BUDGET = 1024;
+// clustered light buffers on this unit and the next two
+const int CLUSTER_LIGHTS_UNIT = 11;
+// the scene is rendered at between the smallest and largest fraction of the
+// window's resolution (per axis) that keeps the frame's GPU time near the
+// target, and scaled up; the UI stays at full resolution
+const float RESOLUTION_TARGET_MS = 16.0f;
+const float RESOLUTION_MIN_SCALE = 0.5f;
+const float RESOLUTION_MAX_SCALE = 1.0f;
+
+// agents wandering the map besides the player
+const unsigned int AGENT_COUNT = 256;
+const float AGENT_RADIUS = 0.08f;
+// agents only wake up when they reach a marker; positions are interpolated
+// when drawn. Separation (agentHash.separate) needs every position each
+// tick, so this mode has none: set false to get it back.
+const bool EVENT_DRIVEN_AGENTS = true;
+// agents this close outside the view are still drawn, for their shadows
+const float AGENT_CULL_MARGIN = 0.5f;
+// event-driven agents follow curves through the markers instead of straight edges
+const bool SMOOTH_AGENT_PATHS = true;
 
 // camera
 Camera camera(glm::vec3(0.0f, 15.0f, 15.0f), glm::vec3(0.0f, 1.0f, 0.0f),
               -90.0f, -45.0f);
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
+// set by framebuffer_size_callback, the scene's framebuffer follows it at the
+// start of the next frame
+int framebufferWidth = SCR_WIDTH, framebufferHeight = SCR_HEIGHT;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 bool firstMouse = true;
@@ -50,47 +142,52 @@ glm::mat4 RTS(glm::vec3 translate = glm::vec3(0.0f, 0.0f, 0.0f),
               float angle = 0.0f,
               glm::vec3 rotation = glm::vec3(1.0f, 0.0f, 0.0f));
 
-void drawObject(Model &objectModel, glm::mat4 model, Shader &shader);
-void drawPlane(Shader &planeShader, glm::vec3 lightPosition, Model &planeModel);
-void setModelShader(Shader &modelShader, glm::vec3 position);
-void drawSkybox(Shader &skyboxShader, unsigned int skyboxVAO, unsigned cubemapTexture);
-void initSkybox(Shader &skyboxShader, unsigned int *skyboxVAO, unsigned int *cubemapTexture);
-void drawArrows(Shader &skyboxShader, int skyboxVAO, unsigned cubemapTexture, glm::mat4 model);
-void initArrows(Shader &arrowShader, unsigned int *arrowVAO, unsigned int *arrowTexture);
-
-int main()
+void drawPlane(RenderQueue &queue, Shader &planeShader, Model &planeModel);
+void initLights(LightsData &lights);
+void fillClusterLights(std::vector<ClusterLight> &lights, const std::vector<Marker> &markers, const Bounds &area,
+                       unsigned int benchmarkCount);
+void setClusterSamplers(Shader &shader);
+void drawSkybox(RenderQueue &queue, Shader &skyboxShader, unsigned int skyboxVAO, unsigned cubemapTexture);
+void initSkybox(Shader &skyboxShader, unsigned int *skyboxVAO, unsigned int *cubemapTexture, JobSystem &jobs);
+void drawTimingOverlay(const FrameProfiler &profiler, const DynamicResolution &resolution,
+                       const RenderQueue::Stats &queueStats);
+bool parseArguments(int argc, char **argv);
+GLFWwindow *createWindow();
+glm::vec3 benchmarkCameraPosition(unsigned int frame, unsigned int frames);
+void dumpFrame(unsigned int frame, const DynamicResolution &resolution);
+void writeBenchmarkReport(std::vector<float> frameTimes, const FrameProfiler &profiler, const char *renderer);
+void writeJobsBenchmark();
+
+int main(int argc, char **argv)
 {
+    if (!parseArguments(argc, argv))
+        return EXIT_FAILURE;
+    if (benchmarkJobs)
+    {
+        writeJobsBenchmark();
+        return EXIT_SUCCESS;
+    }
     srand(glfwGetTime());
-    // Load GLFW and Create a Window
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-    auto mWindow =
-        glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "OpenGL", nullptr, nullptr);
 
-    // Check for Valid Context
-
-    if (mWindow == nullptr)
+    GLFWwindow *mWindow = nullptr;
+    HeadlessContext headless;
+    if (headlessFrames)
+    {
+        if (!headless.create(SCR_WIDTH, SCR_HEIGHT))
+        {
+            fprintf(stderr, "Failed to Create a Headless OpenGL Context (EGL or OSMesa)");
+            return EXIT_FAILURE;
+        }
+        gladLoadGLLoader(headless.loader());
+        loadGLExtensions(headless.loader());
+        LOG_INFO("Headless %s context: %s, %s", headless.api, (const char *)glGetString(GL_RENDERER),
+                 (const char *)glGetString(GL_VERSION));
+    }
+    else if ((mWindow = createWindow()) == nullptr)
     {
-        fprintf(stderr, "Failed to Create OpenGL Context");
         return EXIT_FAILURE;
     }
 
-    glfwMakeContextCurrent(mWindow);
-    glfwSetFramebufferSizeCallback(mWindow, framebuffer_size_callback);
-    glfwSetCursorPosCallback(mWindow, mouse_callback);
-    glfwSetScrollCallback(mWindow, scroll_callback);
-
-    // tell GLFW to capture our mouse
-    glfwSetInputMode(mWindow, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-
-    // Create Context and Load OpenGL Functions
-    glfwMakeContextCurrent(mWindow);
-    gladLoadGL();
-
     // tell stb_image.h to flip loaded texture's on the y-axis (before loading
     // model).
     // stbi_set_flip_vertically_on_load(true);
@@ -106,6 +203,9 @@ int main()
     Shader modelShader("resources/shaders/modelShader.vs",
                        "resources/shaders/modelShader.fs");
 
+    Shader instancedModelShader("resources/shaders/instancedModelShader.vs",
+                                "resources/shaders/modelShader.fs");
+
     Shader skyboxShader("resources/shaders/skyboxShader.vs",
                         "resources/shaders/skyboxShader.fs");
 
@@ -115,8 +215,44 @@ int main()
     Shader arrowShader("resources/shaders/arrowShader.vs",
                        "resources/shaders/arrowShader.fs");
 
+    Shader depthShader("resources/shaders/depthShader.vs",
+                       "resources/shaders/depthShader.fs");
+
+    Shader instancedDepthShader("resources/shaders/instancedDepthShader.vs",
+                                "resources/shaders/depthShader.fs");
+
+    Shader shadowShader("resources/shaders/shadowShader.vs",
+                        "resources/shaders/depthShader.fs");
+
+    Shader instancedShadowShader("resources/shaders/instancedShadowShader.vs",
+                                 "resources/shaders/depthShader.fs");
+
+    // all cube faces in one pass, picked in the vertex shader when the
+    // driver allows it, else in a geometry shader
+    bool vertexShaderLayer = glExtensions().vertexShaderLayer;
+    Shader pointShadowShader(vertexShaderLayer ? "resources/shaders/pointShadowLayerShader.vs"
+                                               : "resources/shaders/pointShadowShader.vs",
+                             "resources/shaders/pointShadow.fs",
+                             vertexShaderLayer ? nullptr : "resources/shaders/pointShadowShader.gs");
+    LOG_INFO("Point light shadow faces selected in the %s shader", vertexShaderLayer ? "vertex" : "geometry");
+
     glm::vec3 lightPos(0.0f, 0.0f, 0.0f);
 
+    // camera and lights, shared by all shaders through uniform blocks
+    UniformBuffer<FrameData> frameUniforms(FRAME_DATA_BINDING);
+    UniformBuffer<LightsData> lightUniforms(LIGHTS_BINDING);
+    initLights(lightUniforms.data);
+    bindFrameUniforms(modelShader);
+    bindFrameUniforms(instancedModelShader);
+    bindFrameUniforms(skyboxShader);
+    bindFrameUniforms(planeShader);
+    bindFrameUniforms(arrowShader);
+    bindFrameUniforms(depthShader);
+    bindFrameUniforms(instancedDepthShader);
+
+    // one pool for simulation and asset decoding
+    JobSystem jobs;
+
     Model planeModel("resources/objects/plane/plane.obj");
     Model markerModel("resources/objects/marker/marker.obj");
     // location of all the markers
@@ -138,68 +274,630 @@ int main()
     }
     markerFile.close();
 
+    // markers don't move, their matrices are uploaded once
+    ModelInstances markerInstances(markerModel);
+    std::vector<glm::mat4> markerMatrices;
+    for (auto &it : markers)
+        markerMatrices.push_back(RTS(it.position, glm::vec3(0.2f), glm::radians(180.0f)));
+    markerInstances.update(markerMatrices);
+
     arrowShader.use();
     arrowShader.setInt("texture1", 0);
 
+    // uniforms that stay the same for the whole run
+    modelShader.use();
+    modelShader.setFloat("shininess", 64.0f);
+    modelShader.setInt("shadowMap", SHADOW_MAP_UNIT);
+    modelShader.setInt("depthMap", POINT_SHADOW_MAP_UNIT);
+    instancedModelShader.use();
+    instancedModelShader.setFloat("shininess", 64.0f);
+    instancedModelShader.setInt("shadowMap", SHADOW_MAP_UNIT);
+    instancedModelShader.setInt("depthMap", POINT_SHADOW_MAP_UNIT);
+    planeShader.use();
+    planeShader.setInt("shadowMap", SHADOW_MAP_UNIT);
+    setClusterSamplers(modelShader);
+    setClusterSamplers(instancedModelShader);
+    setClusterSamplers(planeShader);
+
+    // per-frame instance matrices and indirect commands, FRAMES frames in flight
+    StreamBuffer streamBuffer;
+    LOG_INFO("Stream buffer %s", streamBuffer.persistent ? "persistently mapped" : "orphaned every frame");
+
+    // all draws of a frame, sorted to save state changes
+    RenderQueue renderQueue;
+    renderQueue.stream = &streamBuffer;
+    renderQueue.setDepthShaders(depthShader, instancedDepthShader);
+
     Player player(markers[0], glm::vec3(0.02f));
 
-    unsigned int skyboxVAO, cubemapTexture;
-    initSkybox(skyboxShader, &skyboxVAO, &cubemapTexture);
+    // everything drawn with modelShader.fs samples texture arrays; the
+    // marker and viking textures share one, so the models bind it once
+    TextureArrays textureArrays;
+    textureArrays.add(markerModel);
+    textureArrays.add(player.playerModel);
+    textureArrays.add(player.markerModel);
+    textureArrays.build();
+
+    // look up sampler uniforms now instead of on the first draw
+    planeModel.prepareMaterials(planeShader);
+    markerModel.prepareMaterials(instancedModelShader);
+    player.playerModel.prepareMaterials(modelShader);
+    player.markerModel.prepareMaterials(modelShader);
+
+    SplinePaths agentPaths(markers);
+    Agents agents(markers);
+    if (SMOOTH_AGENT_PATHS)
+        agents.paths = &agentPaths;
+    agents.spawnRandom(AGENT_COUNT);
+    // cells of half the radius, see SpatialHash::separate
+    SpatialHash agentHash(AGENT_RADIUS * 0.5f);
+    AgentScheduler agentScheduler(agents);
+    if (EVENT_DRIVEN_AGENTS)
+        agentScheduler.start();
+    ModelInstances agentInstances(markerModel);
+    agentInstances.stream = &streamBuffer;
+    // of the agents near the view only, and which agent each one is
+    std::vector<glm::mat4> agentMatrices;
+    std::vector<uint32_t> agentIds;
+    agentMatrices.reserve(agents.size());
+    agentIds.reserve(agents.size());
+
+    // directional light shadows; the plane and the markers never move and
+    // are only drawn into the shadow map again when its cascades move
+    ShadowCascades shadowCascades;
+    shadowCascades.stream = &streamBuffer;
+    Bounds sceneBounds;
+    glm::mat4 planeMatrix = RTS(glm::vec3(0.0f, -0.15f, 0.0f), glm::vec3(4.0f));
+    sceneBounds.add(glm::vec3(planeMatrix * glm::vec4(planeModel.bounds.min, 1.0f)));
+    sceneBounds.add(glm::vec3(planeMatrix * glm::vec4(planeModel.bounds.max, 1.0f)));
+    // room above the plane for the markers, the agents and the player
+    sceneBounds.add(glm::vec3(0.0f, 3.0f, 0.0f));
+    // shadows of the light orbiting the player
+    PointShadowMap pointShadows;
+    pointShadows.budget = POINT_SHADOW_BUDGET;
+    pointShadows.stream = &streamBuffer;
+    // a light on every marker, or the benchmark's
+    ClusteredLights clusteredLights;
 
-    // postavljanje buffera za strelice
-    unsigned int arrowVAO, arrowTexture;
-    initArrows(arrowShader, &arrowVAO, &arrowTexture);
+    unsigned int skyboxVAO, cubemapTexture;
+    initSkybox(skyboxShader, &skyboxVAO, &cubemapTexture, jobs);
+
+    // arrows along the edges leaving the player's marker
+    DirectionArrows arrows(loadTexture("resources/textures/arrow.png"));
+
+    // where the frame goes, shown by drawTimingOverlay; the GPU times of the
+    // render queue are per pass, its items are sorted across objects
+    FrameProfiler profiler;
+    const unsigned int PROFILE_FRAME = profiler.add("Frame");
+    const unsigned int PROFILE_STREAM_WAIT = profiler.add("Stream buffer wait");
+    const unsigned int PROFILE_SIMULATION = profiler.add("Simulation");
+    const unsigned int PROFILE_SHADOW_CASCADES = profiler.add("Shadow cascades", true);
+    const unsigned int PROFILE_POINT_SHADOWS = profiler.add("Point shadows");
+    const unsigned int PROFILE_CLUSTERS = profiler.add("Clustered lights");
+    const unsigned int PROFILE_MARKERS = profiler.add("Submit markers");
+    const unsigned int PROFILE_AGENTS = profiler.add("Submit agents");
+    const unsigned int PROFILE_PLAYER = profiler.add("Submit player");
+    const unsigned int PROFILE_ARROWS = profiler.add("Submit arrows");
+    const unsigned int PROFILE_SKYBOX = profiler.add("Submit skybox");
+    const unsigned int PROFILE_PLANE = profiler.add("Submit plane");
+    const unsigned int PROFILE_QUEUE = profiler.add("Render queue");
+    const unsigned int PROFILE_PREPASS = profiler.add("Queue depth prepass");
+    const unsigned int PROFILE_OPAQUE = profiler.add("Queue opaque");
+    const unsigned int PROFILE_SKY = profiler.add("Queue sky");
+    const unsigned int PROFILE_TRANSPARENT = profiler.add("Queue transparent");
+    const unsigned int PROFILE_UPSCALE = profiler.add("Upscale", true);
+    const unsigned int PROFILE_OVERLAY = profiler.add("Overlay", true);
+
+    if (mWindow)
+        glfwGetFramebufferSize(mWindow, &framebufferWidth, &framebufferHeight);
+    DynamicResolution resolution(framebufferWidth, framebufferHeight);
+    resolution.targetMilliseconds = RESOLUTION_TARGET_MS;
+    resolution.minScale = RESOLUTION_MIN_SCALE;
+    resolution.maxScale = RESOLUTION_MAX_SCALE;
+
+    // the benchmark measures the same work every run
+    if (headlessFrames)
+    {
+        dynamicResolution = false;
+        timingOverlay = false;
+    }
+    // wall clock time of every benchmark frame, GPU work included
+    std::vector<float> benchmarkFrameTimes;
+    unsigned int frame = 0;
 
     // Rendering Loop
-    while (glfwWindowShouldClose(mWindow) == false)
+    while (headlessFrames ? frame < headlessFrames : glfwWindowShouldClose(mWindow) == false)
     {
-        float currentFrame = glfwGetTime();
+        auto frameStart = std::chrono::steady_clock::now();
+        float currentFrame = headlessFrames ? (frame + 1) * BENCHMARK_FRAME_TIME : glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        profiler.begin(PROFILE_FRAME);
+
+        lightPos = player.position + glm::vec3(4.0 * sin(currentFrame), 4.0f, 4.0 * cos(currentFrame));
+
+        // the cluster grid and the level of detail viewport read the
+        // resolution's size below
+        resolution.resize(framebufferWidth, framebufferHeight);
+
+        // blocks while the GPU is FRAMES frames behind
+        profiler.begin(PROFILE_STREAM_WAIT);
+        streamBuffer.beginFrame();
+        profiler.end(PROFILE_STREAM_WAIT);
 
-        lightPos = player.position + glm::vec3(4.0 * sin(glfwGetTime()), 4.0f, 4.0 * cos(glfwGetTime()));
+        jobs.processMainThreadJobs();
 
-        processInput(mWindow, player, markers);
+        if (mWindow)
+            processInput(mWindow, player, markers);
+        else
+            camera.LookAt(benchmarkCameraPosition(frame, headlessFrames), glm::vec3(0.0f));
+        profiler.begin(PROFILE_SIMULATION);
         player.processMovement();
 
+        if (EVENT_DRIVEN_AGENTS)
+        {
+            agentScheduler.update(deltaTime);
+        }
+        else
+        {
+            agents.setRandomMovementTargets();
+            agents.processMovement(deltaTime);
+            agentHash.build(agents.position.data(), agents.size());
+            agentHash.separate(agents.position.data(), AGENT_RADIUS, 0.5f, &jobs);
+        }
+
+        frameUniforms.data.projection =
+            glm::perspective(glm::radians(camera.Zoom),
+                             (float)SCR_WIDTH / (float)SCR_HEIGHT, NEAR_PLANE, FAR_PLANE);
+        frameUniforms.data.view = camera.GetViewMatrix();
+        frameUniforms.data.viewPos = camera.Position;
+        frameUniforms.upload();
+        lightUniforms.data.pointLight.position = lightPos;
+        lightUniforms.data.spotLight.position = player.position + glm::vec3(0.0f, 5.0f, 0.0f);
+
+        // positions are only worked out for agents whose marker
+        // neighbourhood is in view
+        agentMatrices.clear();
+        agentIds.clear();
+        agents.forEachVisible(Frustum(frameUniforms.data.projection * frameUniforms.data.view), AGENT_CULL_MARGIN,
+                              [&](size_t i) {
+                                  glm::vec3 agentPosition = EVENT_DRIVEN_AGENTS
+                                                                ? agents.positionAt(i, agentScheduler.time)
+                                                                : agents.position[i];
+                                  agentMatrices.push_back(
+                                      RTS(agentPosition, glm::vec3(0.05f), glm::radians(180.0f)));
+                                  agentIds.push_back(i);
+                              });
+        // each agent keeps its level of detail whatever slot it lands in
+        agentInstances.update(agentMatrices, agentIds);
+        profiler.end(PROFILE_SIMULATION);
+
+        if (shadows)
+        {
+            FrameProfiler::Scope scope(profiler, PROFILE_SHADOW_CASCADES);
+            shadowCascades.update(frameUniforms.data.view, glm::radians(camera.Zoom),
+                                  (float)SCR_WIDTH / (float)SCR_HEIGHT, NEAR_PLANE,
+                                  lightUniforms.data.dirLight.direction, sceneBounds);
+            shadowCascades.render(shadowShader, instancedShadowShader,
+                                  [&](RenderQueue &queue, ShadowCascades::Casters casters) {
+                                      if (casters == ShadowCascades::CASTERS_STATIC)
+                                      {
+                                          drawPlane(queue, planeShader, planeModel);
+                                          markerInstances.submit(queue, instancedModelShader);
+                                      }
+                                      else
+                                      {
+                                          agentInstances.submit(queue, instancedModelShader);
+                                          player.submit(queue, modelShader);
+                                      }
+                                  });
+            LOG_DEBUG_RATE(1, "Shadows: %u of %d static cascades redrawn", shadowCascades.staticRenders,
+                           (int)ShadowCascades::CASCADE_COUNT);
+            for (int c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+                lightUniforms.data.cascadeMatrices[c] = shadowCascades.lightMatrices[c];
+            glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_UNIT);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, shadowCascades.shadowMap);
+            glActiveTexture(GL_TEXTURE0);
+        }
+        lightUniforms.data.cascadeSplits = shadowCascades.splitsUniform(shadows);
+
+        if (shadows)
+        {
+            FrameProfiler::Scope scope(profiler, PROFILE_POINT_SHADOWS);
+            pointShadows.begin(lightPos);
+            pointShadows.add(markerModel, markerInstances.instanceMatrices());
+            pointShadows.add(markerModel, agentMatrices);
+            pointShadows.add(player.playerModel, player.playerMatrix());
+            pointShadows.add(player.markerModel, player.markerMatrix());
+            // sharp enough around the player, who the light circles
+            float pixelsPerUnit = frameUniforms.data.projection[1][1] * resolution.height() * 0.5f;
+            pointShadows.chooseSize(glm::length(lightPos - player.position),
+                                    glm::length(camera.Position - player.position), pixelsPerUnit);
+            pointShadows.render(pointShadowShader);
+            profiler.setGpu(PROFILE_POINT_SHADOWS, pointShadows.timer.milliseconds);
+            LOG_DEBUG_RATE(1, "Point shadows: %u casters, %u faces drawn, %u culled, %u draw calls, %ux%u, %.3f ms",
+                           pointShadows.stats.casters, pointShadows.stats.faces, pointShadows.stats.facesCulled,
+                           pointShadows.stats.drawCalls, pointShadows.size, pointShadows.size,
+                           pointShadows.timer.milliseconds);
+            glActiveTexture(GL_TEXTURE0 + POINT_SHADOW_MAP_UNIT);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, pointShadows.depthCubemap);
+            glActiveTexture(GL_TEXTURE0);
+        }
+        lightUniforms.data.pointLight.shadowFarPlane = shadows ? pointShadows.farPlane : 0.0f;
+
+        profiler.begin(PROFILE_CLUSTERS);
+        fillClusterLights(clusteredLights.lights, markers, sceneBounds, BENCHMARK_LIGHT_COUNTS[benchmarkLights]);
+        clusteredLights.build(frameUniforms.data.view, frameUniforms.data.projection, NEAR_PLANE, FAR_PLANE);
+        clusteredLights.bind(CLUSTER_LIGHTS_UNIT);
+        lightUniforms.data.clusterGrid = clusteredLights.gridUniform();
+        lightUniforms.data.clusterScale = clusteredLights.scaleUniform(resolution.width(), resolution.height());
+        profiler.end(PROFILE_CLUSTERS);
+        LOG_DEBUG_RATE(1, "Clustered lights: %u lights, %u visible, %u cluster entries, %.3f ms to build",
+                       clusteredLights.stats.lights, clusteredLights.stats.visible, clusteredLights.stats.indices,
+                       clusteredLights.stats.milliseconds);
+        lightUniforms.upload();
+
+        // the shadow passes are done with their framebuffers
+        resolution.begin();
         // Background Fill Color
         glClearColor(0.25f, 0.25f, 0.25f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        setModelShader(modelShader, lightPos);
-        for (auto &it : markers)
+        renderQueue.depthPrepass = depthPrepass;
+        renderQueue.viewportHeight = resolution.height();
+        renderQueue.begin(frameUniforms.data.projection, frameUniforms.data.view, FAR_PLANE);
+
+        profiler.begin(PROFILE_MARKERS);
+        markerInstances.submit(renderQueue, instancedModelShader);
+        profiler.end(PROFILE_MARKERS);
+        profiler.begin(PROFILE_AGENTS);
+        agentInstances.submit(renderQueue, instancedModelShader);
+        profiler.end(PROFILE_AGENTS);
+
+        profiler.begin(PROFILE_PLAYER);
+        player.submit(renderQueue, modelShader);
+        profiler.end(PROFILE_PLAYER);
+
+        profiler.begin(PROFILE_ARROWS);
+        arrows.update(markers, player.currentMarker->idx);
+        arrows.submit(renderQueue, arrowShader);
+        profiler.end(PROFILE_ARROWS);
+        profiler.begin(PROFILE_SKYBOX);
+        drawSkybox(renderQueue, skyboxShader, skyboxVAO, cubemapTexture);
+        profiler.end(PROFILE_SKYBOX);
+
+        profiler.begin(PROFILE_PLANE);
+        drawPlane(renderQueue, planeShader, planeModel);
+        profiler.end(PROFILE_PLANE);
+
+        profiler.begin(PROFILE_QUEUE);
+        renderQueue.flush();
+        profiler.end(PROFILE_QUEUE);
+        profiler.setGpu(PROFILE_QUEUE, renderQueue.gpuTimes.total());
+        profiler.setGpu(PROFILE_PREPASS, renderQueue.gpuTimes.prepass);
+        profiler.setGpu(PROFILE_OPAQUE, renderQueue.gpuTimes.opaque);
+        profiler.setGpu(PROFILE_SKY, renderQueue.gpuTimes.sky);
+        profiler.setGpu(PROFILE_TRANSPARENT, renderQueue.gpuTimes.transparent);
+        LOG_DEBUG_RATE(1, "Render queue: %u submitted, %u culled; %u items, %u programs, %u VAOs, "
+                          "%u textures bound, %u binds saved; %u draw calls, %u merged",
+                       renderQueue.stats.submitted, renderQueue.stats.culled, renderQueue.stats.items,
+                       renderQueue.stats.programBinds, renderQueue.stats.vaoBinds,
+                       renderQueue.stats.textureBinds, renderQueue.stats.bindsSaved(),
+                       renderQueue.stats.drawCalls, renderQueue.stats.drawsMerged);
+        LOG_DEBUG_RATE(1, "GPU ms: prepass %.3f, opaque %.3f, sky %.3f, transparent %.3f, total %.3f (prepass %s)",
+                       renderQueue.gpuTimes.prepass, renderQueue.gpuTimes.opaque, renderQueue.gpuTimes.sky,
+                       renderQueue.gpuTimes.transparent, renderQueue.gpuTimes.total(), depthPrepass ? "on" : "off");
+        LOG_DEBUG_RATE(1, "Stream buffer: waited %.3f ms for the GPU, %.3f ms at most in the last second",
+                       streamBuffer.waitMilliseconds, streamBuffer.maxWaitMilliseconds);
+
+        // without a window the scene stays in the offscreen framebuffer
+        if (mWindow)
+        {
+            profiler.begin(PROFILE_UPSCALE);
+            resolution.present();
+            profiler.end(PROFILE_UPSCALE);
+        }
+        else if (std::find(dumpFrames.begin(), dumpFrames.end(), frame) != dumpFrames.end())
         {
-            drawObject(markerModel, RTS(it.position, glm::vec3(0.2f), glm::radians(180.0f)),
-                       modelShader);
+            dumpFrame(frame, resolution);
         }
-        player.draw(modelShader);
 
-        glm::mat4 arrowModel = RTS(player.position + glm::vec3(0.0f, 0.0f, 0.7f), glm::vec3(0.3f), glm::radians(90.0f));
-        drawArrows(arrowShader, arrowVAO, arrowTexture, arrowModel);
-        arrowModel = RTS(player.position + glm::vec3(0.5f, 0.0f, 0.5f), glm::vec3(0.3f), glm::radians(90.0f));
-        arrowModel = glm::rotate(arrowModel, glm::radians(45.0f), glm::vec3(0.0f, 0.0f, -1.0f));
-        drawArrows(arrowShader, arrowVAO, arrowTexture, arrowModel);
-        drawSkybox(skyboxShader, skyboxVAO, cubemapTexture);
+        if (timingOverlay)
+        {
+            FrameProfiler::Scope scope(profiler, PROFILE_OVERLAY);
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+            drawTimingOverlay(profiler, resolution, renderQueue.stats);
+            ImGui::Render();
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
+        streamBuffer.endFrame();
+        profiler.end(PROFILE_FRAME);
+        profiler.endFrame();
+        // all the GPU work of the frame that is known
+        resolution.enabled = dynamicResolution;
+        resolution.update(profiler.lastGpu(PROFILE_SHADOW_CASCADES) + profiler.lastGpu(PROFILE_POINT_SHADOWS) +
+                          profiler.lastGpu(PROFILE_QUEUE) + profiler.lastGpu(PROFILE_UPSCALE) +
+                          profiler.lastGpu(PROFILE_OVERLAY));
+        if (exportTimings)
+        {
+            exportTimings = false;
+            if (profiler.exportCsv(TIMINGS_FILE))
+                LOG_INFO("Frame timings written to %s", TIMINGS_FILE);
+            else
+                LOG_WARN("Could not write frame timings to %s", TIMINGS_FILE);
+        }
 
-        drawPlane(planeShader, player.position, planeModel);
+        if (headlessFrames)
+        {
+            // nothing waits for a swap, so wait for the GPU to count its work
+            glFinish();
+            if (frame >= BENCHMARK_WARMUP_FRAMES)
+                benchmarkFrameTimes.push_back(std::chrono::duration<float, std::milli>(
+                                                  std::chrono::steady_clock::now() - frameStart)
+                                                  .count());
+            frame++;
+            continue;
+        }
 
         // Flip Buffers and Draw
         glfwSwapBuffers(mWindow);
         glfwPollEvents();
     }
+    if (headlessFrames)
+    {
+        writeBenchmarkReport(benchmarkFrameTimes, profiler, (const char *)glGetString(GL_RENDERER));
+        return EXIT_SUCCESS;
+    }
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui_ImplGlfw_Shutdown();
+    ImGui::DestroyContext();
     glfwTerminate();
     return EXIT_SUCCESS;
 }
 
-void renderScene()
+// reads --headless FRAMES and --dump N,N,...
+bool parseArguments(int argc, char **argv)
 {
+    for (int i = 1; i < argc; i++)
+    {
+        if (!std::strcmp(argv[i], "--headless") && i + 1 < argc)
+        {
+            headlessFrames = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!std::strcmp(argv[i], "--bench-jobs"))
+        {
+            benchmarkJobs = true;
+        }
+        else if (!std::strcmp(argv[i], "--dump") && i + 1 < argc)
+        {
+            for (char *next = argv[++i]; *next;)
+            {
+                dumpFrames.push_back(std::strtoul(next, &next, 10));
+                if (*next == ',')
+                    next++;
+                else if (*next)
+                    break;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--headless FRAMES [--dump FRAME,FRAME,...]] [--bench-jobs]\n", argv[0]);
+            return false;
+        }
+    }
+    return true;
 }
 
-void drawObject(Model &objectModel, glm::mat4 model, Shader &shader)
+GLFWwindow *createWindow()
+{
+    // Load GLFW and Create a Window
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+    auto mWindow =
+        glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "OpenGL", nullptr, nullptr);
+
+    // Check for Valid Context
+
+    if (mWindow == nullptr)
+    {
+        fprintf(stderr, "Failed to Create OpenGL Context");
+        return nullptr;
+    }
+
+    glfwMakeContextCurrent(mWindow);
+    glfwSetFramebufferSizeCallback(mWindow, framebuffer_size_callback);
+    glfwSetCursorPosCallback(mWindow, mouse_callback);
+    glfwSetScrollCallback(mWindow, scroll_callback);
+
+    // tell GLFW to capture our mouse
+    glfwSetInputMode(mWindow, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+    // Create Context and Load OpenGL Functions
+    glfwMakeContextCurrent(mWindow);
+    gladLoadGL();
+    loadGLExtensions((GLADloadproc)glfwGetProcAddress);
+
+    // only draws the timing overlay, input stays with the camera
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGui::GetIO().ConfigFlags |= ImGuiConfigFlags_NoMouse;
+    ImGui::GetIO().IniFilename = nullptr;
+    ImGui_ImplGlfw_InitForOpenGL(mWindow, false);
+    ImGui_ImplOpenGL3_Init("#version 330 core");
+
+    return mWindow;
+}
+
+// one turn around the map, rising and sinking twice, over frames frames
+glm::vec3 benchmarkCameraPosition(unsigned int frame, unsigned int frames)
+{
+    float angle = 2.0f * glm::pi<float>() * frame / std::max(frames, 1u);
+    return glm::vec3(15.0f * sin(angle), 12.0f + 4.0f * sin(2.0f * angle), 15.0f * cos(angle));
+}
+
+// writes the scene of the offscreen framebuffer to frame_<frame>.png
+void dumpFrame(unsigned int frame, const DynamicResolution &resolution)
+{
+    std::vector<unsigned char> pixels((size_t)resolution.width() * resolution.height() * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, resolution.FBO);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, resolution.width(), resolution.height(), GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    std::string path = "frame_" + std::to_string(frame) + ".png";
+    if (PngWriter::write(path.c_str(), resolution.width(), resolution.height(), pixels.data()))
+        LOG_INFO("Frame %u written to %s", frame, path.c_str());
+    else
+        LOG_WARN("Could not write frame %u to %s", frame, path.c_str());
+}
+
+// frame time statistics of a benchmark run to BENCHMARK_FILE, and the
+// profiler's per section history to TIMINGS_FILE
+void writeBenchmarkReport(std::vector<float> frameTimes, const FrameProfiler &profiler, const char *renderer)
+{
+    if (frameTimes.empty())
+    {
+        LOG_WARN("No benchmark frames after the %u warm-up frames", BENCHMARK_WARMUP_FRAMES);
+        return;
+    }
+    std::sort(frameTimes.begin(), frameTimes.end());
+    float total = 0.0f;
+    for (float time : frameTimes)
+        total += time;
+    float mean = total / frameTimes.size();
+    auto percentile = [&](float p) { return frameTimes[(size_t)(p * (frameTimes.size() - 1) + 0.5f)]; };
+
+    FILE *file = fopen(BENCHMARK_FILE, "w");
+    if (!file)
+    {
+        LOG_WARN("Could not write %s", BENCHMARK_FILE);
+        return;
+    }
+    fprintf(file, "renderer: %s\n", renderer ? renderer : "unknown");
+    fprintf(file, "resolution: %ux%u\n", SCR_WIDTH, SCR_HEIGHT);
+    fprintf(file, "frames: %zu (after %u warm-up)\n", frameTimes.size(), BENCHMARK_WARMUP_FRAMES);
+    fprintf(file, "frame ms: mean %.3f, min %.3f, median %.3f, p95 %.3f, p99 %.3f, max %.3f\n", mean,
+            frameTimes.front(), percentile(0.5f), percentile(0.95f), percentile(0.99f), frameTimes.back());
+    fprintf(file, "fps: %.1f\n", 1000.0f / mean);
+    fprintf(file, "section averages over the last %u frames, CPU / GPU ms:\n", (unsigned int)FrameProfiler::HISTORY);
+    for (unsigned int id = 0; id < profiler.sections.size(); id++)
+        fprintf(file, "  %-22s %8.3f %8.3f\n", profiler.sections[id].name.c_str(), profiler.averageCpu(id),
+                profiler.averageGpu(id));
+    fclose(file);
+    LOG_INFO("Benchmark: %zu frames, mean %.3f ms, p95 %.3f ms, written to %s", frameTimes.size(), mean,
+             percentile(0.95f), BENCHMARK_FILE);
+    if (!profiler.exportCsv(TIMINGS_FILE))
+        LOG_WARN("Could not write frame timings to %s", TIMINGS_FILE);
+}
+
+void writeJobsBenchmark()
+{
+    using Clock = std::chrono::steady_clock;
+    auto microseconds = [](Clock::time_point start) {
+        return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    };
+    // the median of a few runs, against the noise of other processes
+    auto median = [](std::vector<double> runs) {
+        std::sort(runs.begin(), runs.end());
+        return runs[runs.size() / 2];
+    };
+    const int RUNS = 7;
+    JobSystem jobs;
+
+    // spawning and running jobs that do nothing: the cost of a job
+    const int EMPTY_JOBS = 10000;
+    std::vector<double> perJob;
+    for (int run = 0; run < RUNS; run++)
+    {
+        TaskGroup group;
+        auto start = Clock::now();
+        for (int i = 0; i < EMPTY_JOBS; i++)
+            jobs.run(group, [] {});
+        jobs.wait(group);
+        perJob.push_back(microseconds(start) / EMPTY_JOBS);
+    }
+
+    // a parallelFor of empty chunks: the fixed cost of splitting a loop
+    const int CHUNKS = 8, LOOPS = 2000;
+    std::vector<double> perLoop;
+    for (int run = 0; run < RUNS; run++)
+    {
+        auto start = Clock::now();
+        for (int i = 0; i < LOOPS; i++)
+            jobs.parallelFor(0, CHUNKS, 1, [](size_t, size_t) {});
+        perLoop.push_back(microseconds(start) / LOOPS);
+    }
+
+    // uneven work split into small chunks, which idle threads steal: wall
+    // time against doing it all on this thread
+    const size_t ITEMS = 4096;
+    std::vector<float> results(ITEMS);
+    auto work = [&results](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++)
+        {
+            float x = 0.0f;
+            for (size_t k = 0; k < 200 + (i % 64) * 20; k++)
+                x += std::sqrt((float)(k + i));
+            results[i] = x;
+        }
+    };
+    std::vector<double> serial, parallel;
+    for (int run = 0; run < RUNS; run++)
+    {
+        auto start = Clock::now();
+        work(0, ITEMS);
+        serial.push_back(microseconds(start));
+        start = Clock::now();
+        jobs.parallelFor(0, ITEMS, 16, work);
+        parallel.push_back(microseconds(start));
+    }
+
+    // a job pushed while the workers sleep, until one of them starts it; the
+    // main thread only spins, so it doesn't run the job itself
+    std::vector<double> wakeups;
+    for (int run = 0; run < RUNS && jobs.threadCount() > 1; run++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        std::atomic<bool> started{false};
+        TaskGroup group;
+        auto start = Clock::now();
+        jobs.run(group, [&started] { started.store(true, std::memory_order_release); });
+        while (!started.load(std::memory_order_acquire))
+            std::this_thread::yield();
+        wakeups.push_back(microseconds(start));
+        jobs.wait(group);
+    }
+
+    FILE *file = fopen(JOBS_BENCHMARK_FILE, "w");
+    if (!file)
+    {
+        LOG_WARN("Could not write %s", JOBS_BENCHMARK_FILE);
+        return;
+    }
+    for (FILE *out : {stdout, file})
+    {
+        fprintf(out, "threads: %u (hardware %u), median of %d runs\n", jobs.threadCount(),
+                std::thread::hardware_concurrency(), RUNS);
+        fprintf(out, "empty job, spawn to done: %.3f us\n", median(perJob));
+        fprintf(out, "parallelFor of %d empty chunks: %.3f us\n", CHUNKS, median(perLoop));
+        fprintf(out, "uneven work, %zu items in chunks of 16: serial %.1f us, parallel %.1f us, speedup %.2f\n",
+                ITEMS, median(serial), median(parallel), median(serial) / median(parallel));
+        if (wakeups.empty())
+            fprintf(out, "sleeping worker wake-up: no workers\n");
+        else
+            fprintf(out, "sleeping worker wake-up: %.1f us\n", median(wakeups));
+    }
+    fclose(file);
+    LOG_INFO("Job system benchmark written to %s", JOBS_BENCHMARK_FILE);
+}
+
+void renderScene()
 {
-    shader.use();
-    shader.setMat4("model", model);
-    objectModel.Draw(shader);
 }
 
 glm::mat4 RTS(glm::vec3 translate, glm::vec3 scale, float angle, glm::vec3 rotation)
@@ -227,6 +925,56 @@ void processInput(GLFWwindow *window, Player &player,
         camera.ProcessKeyboard(RIGHT, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
         player.setRandomMovementTarget();
+    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && !depthPrepassKeyPressed)
+    {
+        depthPrepass = !depthPrepass;
+        depthPrepassKeyPressed = true;
+        LOG_INFO("Depth prepass %s", depthPrepass ? "on" : "off");
+    }
+    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_RELEASE)
+        depthPrepassKeyPressed = false;
+    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS && !shadowsKeyPressed)
+    {
+        shadows = !shadows;
+        shadowsKeyPressed = true;
+        LOG_INFO("Shadows %s", shadows ? "on" : "off");
+    }
+    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_RELEASE)
+        shadowsKeyPressed = false;
+    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS && !benchmarkLightsKeyPressed)
+    {
+        unsigned int choices = sizeof(BENCHMARK_LIGHT_COUNTS) / sizeof(BENCHMARK_LIGHT_COUNTS[0]);
+        benchmarkLights = (benchmarkLights + 1) % choices;
+        benchmarkLightsKeyPressed = true;
+        if (benchmarkLights)
+            LOG_INFO("Clustered lighting benchmark with %u lights", BENCHMARK_LIGHT_COUNTS[benchmarkLights]);
+        else
+            LOG_INFO("Clustered lighting benchmark off");
+    }
+    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_RELEASE)
+        benchmarkLightsKeyPressed = false;
+    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS && !timingOverlayKeyPressed)
+    {
+        timingOverlay = !timingOverlay;
+        timingOverlayKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_RELEASE)
+        timingOverlayKeyPressed = false;
+    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS && !exportTimingsKeyPressed)
+    {
+        exportTimings = true;
+        exportTimingsKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_RELEASE)
+        exportTimingsKeyPressed = false;
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS && !dynamicResolutionKeyPressed)
+    {
+        dynamicResolution = !dynamicResolution;
+        dynamicResolutionKeyPressed = true;
+        LOG_INFO("Dynamic resolution %s", dynamicResolution ? "on" : "off");
+    }
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_RELEASE)
+        dynamicResolutionKeyPressed = false;
     //  if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
     //     camera.ProcessKeyboard(RIGHT, deltaTime);
     // if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
@@ -244,6 +992,8 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height)
     // width and height will be significantly larger than specified on
     // retina displays.
     glViewport(0, 0, width, height);
+    framebufferWidth = width;
+    framebufferHeight = height;
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -274,21 +1024,32 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(yoffset);
 }
 
-unsigned int loadCubemap(std::vector<std::string> faces)
+unsigned int loadCubemap(std::vector<std::string> faces, JobSystem &jobs)
 {
     unsigned int textureID;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-    int width, height, nrChannels;
+    // decode all faces in parallel, the upload has to stay on this thread
+    struct Image
+    {
+        unsigned char *data;
+        int width, height, nrChannels;
+    };
+    std::vector<Image> images(faces.size());
+    jobs.parallelFor(0, faces.size(), 1, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++)
+            images[i].data = stbi_load(faces[i].c_str(), &images[i].width, &images[i].height,
+                                       &images[i].nrChannels, 0);
+    });
+
     for (unsigned int i = 0; i < faces.size(); i++)
     {
-        unsigned char *data =
-            stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
+        unsigned char *data = images[i].data;
         if (data)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width,
-                         height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, images[i].width,
+                         images[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
             stbi_image_free(data);
         }
         else
@@ -307,93 +1068,90 @@ unsigned int loadCubemap(std::vector<std::string> faces)
     return textureID;
 }
 
-void drawPlane(Shader &planeShader, glm::vec3 lightPosition,
-               Model &planeModel)
+void drawPlane(RenderQueue &queue, Shader &planeShader, Model &planeModel)
 {
+    queue.submit(planeShader, planeModel, RTS(glm::vec3(0.0f, -0.15f, 0.0f), glm::vec3(4.0f)),
+                 RenderQueue::PASS_OPAQUE, RenderQueue::STATE_CULL_BACK);
+}
 
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-
-    planeShader.use();
-
-    planeShader.setVec3("viewPos", camera.Position);
-    planeShader.setInt("shadows", 0); // enable/disable shadows by pressing 'SPACE'
-
-    planeShader.setVec3("viewPos", camera.Position);
-    planeShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-    planeShader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
-    planeShader.setVec3("dirLight.diffuse", 0.1f, 0.1f, 0.1f);
-    planeShader.setVec3("spotLight.position",
-                        lightPosition + glm::vec3(0.0f, 5.0f, 0.0f));
-    planeShader.setVec3("spotLight.direction", glm::vec3(0.0f, -1.0f, 0.0f));
-    planeShader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-    planeShader.setVec3("spotLight.diffuse", 1.0f, 1.0f, 1.0f);
-    planeShader.setFloat("spotLight.constant", 1.0f);
-    planeShader.setFloat("spotLight.linear", 0.09f);
-    planeShader.setFloat("spotLight.quadratic", 0.032f);
-    planeShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(45.0f)));
-    planeShader.setFloat("spotLight.outerCutOff",
-                         glm::cos(glm::radians(50.0f)));
-
-    glm::mat4 projection =
-        glm::perspective(glm::radians(camera.Zoom),
-                         (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    glm::mat4 view = camera.GetViewMatrix();
-    planeShader.setMat4("projection", projection);
-    planeShader.setMat4("view", view);
-    drawObject(planeModel, RTS(glm::vec3(0.0f, -0.15f, 0.0f), glm::vec3(4.0f)),
-               planeShader);
-
-    glDisable(GL_CULL_FACE);
+// light parameters that stay the same for the whole run; positions of the
+// point light and the spot light follow the player and are set every frame
+void initLights(LightsData &lights)
+{
+    lights.dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+    lights.dirLight.ambient = glm::vec3(0.05f, 0.05f, 0.05f);
+    lights.dirLight.diffuse = glm::vec3(0.4f, 0.4f, 0.4f);
+    lights.dirLight.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+
+    lights.mapDirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+    lights.mapDirLight.ambient = glm::vec3(0.05f, 0.05f, 0.05f);
+    lights.mapDirLight.diffuse = glm::vec3(0.1f, 0.1f, 0.1f);
+
+    lights.pointLight.ambient = glm::vec3(0.05f, 0.05f, 0.05f);
+    lights.pointLight.diffuse = glm::vec3(0.8f, 0.8f, 0.8f);
+    lights.pointLight.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+    lights.pointLight.constant = 1.0f;
+    lights.pointLight.linear = 0.09f;
+    lights.pointLight.quadratic = 0.032f;
+
+    lights.spotLight.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    lights.spotLight.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+    lights.spotLight.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+    lights.spotLight.constant = 1.0f;
+    lights.spotLight.linear = 0.09f;
+    lights.spotLight.quadratic = 0.032f;
+    lights.spotLight.cutOff = glm::cos(glm::radians(45.0f));
+    lights.spotLight.outerCutOff = glm::cos(glm::radians(50.0f));
 }
 
-void setModelShader(Shader &modelShader, glm::vec3 position)
+// a light above every marker, or benchmarkCount lights spread over area
+// with fixed random positions, sizes and colors when that isn't 0
+void fillClusterLights(std::vector<ClusterLight> &lights, const std::vector<Marker> &markers, const Bounds &area,
+                       unsigned int benchmarkCount)
 {
-    modelShader.use();
-    modelShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-    modelShader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
-    modelShader.setVec3("dirLight.diffuse", 0.4f, 0.4f, 0.4f);
-    modelShader.setVec3("dirLight.specular", 1.0f, 1.0f, 1.0f);
-    modelShader.setFloat("shininess", 64.0f);
+    lights.clear();
+    if (benchmarkCount)
+    {
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (unsigned int i = 0; i < benchmarkCount; i++)
+        {
+            ClusterLight light = ClusterLight();
+            light.position = glm::vec3(glm::mix(area.min.x, area.max.x, unit(random)), 0.5f,
+                                       glm::mix(area.min.z, area.max.z, unit(random)));
+            light.radius = glm::mix(1.5f, 3.0f, unit(random));
+            light.color = glm::vec3(unit(random), unit(random), unit(random));
+            lights.push_back(light);
+        }
+        return;
+    }
+    for (const Marker &marker : markers)
+    {
+        ClusterLight light = ClusterLight();
+        light.position = marker.position + glm::vec3(0.0f, 0.6f, 0.0f);
+        light.radius = 2.5f;
+        light.color = glm::vec3(1.0f, 0.7f, 0.4f);
+        lights.push_back(light);
+    }
+}
 
-    modelShader.setVec3("pointLight.position", position);
-    modelShader.setVec3("pointLight.ambient", 0.05f, 0.05f, 0.05f);
-    modelShader.setVec3("pointLight.diffuse", 0.8f, 0.8f, 0.8f);
-    modelShader.setVec3("pointLight.specular", 1.0f, 1.0f, 1.0f);
-    modelShader.setFloat("pointLight.constant", 1.0f);
-    modelShader.setFloat("pointLight.linear", 0.09);
-    modelShader.setFloat("pointLight.quadratic", 0.032);
-
-    glm::mat4 projection =
-        glm::perspective(glm::radians(camera.Zoom),
-                         (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    glm::mat4 view = camera.GetViewMatrix();
-    modelShader.setMat4("projection", projection);
-    modelShader.setMat4("view", view);
+void setClusterSamplers(Shader &shader)
+{
+    shader.use();
+    shader.setInt("clusterLights", CLUSTER_LIGHTS_UNIT);
+    shader.setInt("clusterRanges", CLUSTER_LIGHTS_UNIT + 1);
+    shader.setInt("clusterIndices", CLUSTER_LIGHTS_UNIT + 2);
 }
 
-void drawSkybox(Shader &skyboxShader, unsigned int skyboxVAO, unsigned cubemapTexture)
+void drawSkybox(RenderQueue &queue, Shader &skyboxShader, unsigned int skyboxVAO, unsigned cubemapTexture)
 {
-    glDepthFunc(GL_LEQUAL); // change depth function so depth test passes when
-                            // values are equal to depth buffer's content
-    skyboxShader.use();
-    glm::mat4 view = glm::mat4(glm::mat3(
-        camera.GetViewMatrix())); // remove translation from the view matrix
-    glm::mat4 projection =
-        glm::perspective(glm::radians(camera.Zoom),
-                         (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    skyboxShader.setMat4("view", view);
-    skyboxShader.setMat4("projection", projection);
-    // skybox cube
-    glBindVertexArray(skyboxVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
-    glDepthFunc(GL_LESS);
+    // the skybox is drawn at the far plane, so the depth test has to pass
+    // where the depth buffer was cleared to 1.0
+    queue.submit(skyboxShader, skyboxVAO, 36, false, GL_TEXTURE_CUBE_MAP, cubemapTexture,
+                 glm::mat4(1.0f), RenderQueue::PASS_SKY, RenderQueue::STATE_DEPTH_LEQUAL);
 }
 
-void initSkybox(Shader &skyboxShader, unsigned int *skyboxVAO, unsigned int *cubemapTexture)
+void initSkybox(Shader &skyboxShader, unsigned int *skyboxVAO, unsigned int *cubemapTexture, JobSystem &jobs)
 {
     float skyboxVertices[] = {
         // positions
@@ -434,69 +1192,45 @@ void initSkybox(Shader &skyboxShader, unsigned int *skyboxVAO, unsigned int *cub
                                       "resources/Skybox/front.jpg",
                                       "resources/Skybox/back.jpg"};
 
-    *cubemapTexture = loadCubemap(faces);
+    *cubemapTexture = loadCubemap(faces, jobs);
     skyboxShader.use();
     skyboxShader.setInt("skybox", 0);
 }
 
-void initArrows(Shader &arrowShader,
-                unsigned int *arrowVAO,
-                unsigned int *arrowTexture)
+// CPU and GPU milliseconds of every section, last frame and average, with
+// a graph of the CPU time (or the GPU time of sections that only have one)
+void drawTimingOverlay(const FrameProfiler &profiler, const DynamicResolution &resolution,
+                       const RenderQueue::Stats &queueStats)
 {
-
-    // Crtanje strelica
-    float arrowVertices[] = {
-        // positions          // texture coords
-        0.5f, 0.5f, 0.0f, 1.0f, 1.0f,   // top right
-        0.5f, -0.5f, 0.0f, 1.0f, 0.0f,  // bottom right
-        -0.5f, -0.5f, 0.0f, 0.0f, 0.0f, // bottom left
-        -0.5f, 0.5f, 0.0f, 0.0f, 1.0f   // top left
-    };
-    unsigned int indices[] = {
-        0, 1, 3, // first triangle
-        1, 2, 3  // second triangle
-    };
-
-    unsigned int arrowVBO, arrowEBO;
-    glGenVertexArrays(1, arrowVAO);
-    glGenBuffers(1, &arrowVBO);
-    glGenBuffers(1, &arrowEBO);
-
-    glBindVertexArray(*arrowVAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, arrowVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(arrowVertices), arrowVertices, GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arrowEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
-    // texture coord attribute
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    *arrowTexture = loadTexture("resources/textures/arrow.png");
-
-    arrowShader.use();
-    arrowShader.setInt("texture1", 0);
-}
-
-void drawArrows(Shader &arrowShader, int arrowVAO, unsigned arrowTexture, glm::mat4 model)
-{
-    arrowShader.use();
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    glm::mat4 view = camera.GetViewMatrix();
-    arrowShader.setMat4("projection", projection);
-    arrowShader.setMat4("view", view);
-
-    arrowShader.setMat4("model", model);
-
-    glBindVertexArray(arrowVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, arrowTexture);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f));
+    ImGui::SetNextWindowBgAlpha(0.6f);
+    ImGui::Begin("Frame timing", nullptr,
+                 ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings |
+                     ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav);
+    ImGui::Text("%-22s %7s %7s %7s %7s", "ms", "CPU", "avg", "GPU", "avg");
+    for (unsigned int id = 0; id < profiler.sections.size(); id++)
+    {
+        const FrameProfiler::Section &section = profiler.sections[id];
+        ImGui::Text("%-22s %7.3f %7.3f %7.3f %7.3f", section.name.c_str(), profiler.lastCpu(id),
+                    profiler.averageCpu(id), profiler.lastGpu(id), profiler.averageGpu(id));
+        ImGui::SameLine();
+        bool cpu = profiler.averageCpu(id) > 0.0f || profiler.averageGpu(id) == 0.0f;
+        ImGui::PushID(id);
+        ImGui::PlotLines("##history", cpu ? section.cpuHistory : section.gpuHistory, FrameProfiler::HISTORY,
+                         profiler.next, nullptr, 0.0f, FLT_MAX, ImVec2(160.0f, 14.0f));
+        ImGui::PopID();
+    }
+    // the render queue of the scene, this frame
+    ImGui::Text("Culling: %u submitted, %u culled", queueStats.submitted, queueStats.culled);
+    ImGui::Text("Binds: %u programs, %u VAOs, %u textures, %u states; %u saved", queueStats.programBinds,
+                queueStats.vaoBinds, queueStats.textureBinds, queueStats.stateChanges, queueStats.bindsSaved());
+    ImGui::Text("Draws: %u items, %u draw calls, %u merged into multi-draws", queueStats.items,
+                queueStats.drawCalls, queueStats.drawsMerged);
+    ImGui::Text("Scene at %ux%u (%.0f%%), GPU target %.1f ms, dynamic resolution %s", resolution.width(),
+                resolution.height(), resolution.scale * 100.0f, resolution.targetMilliseconds,
+                resolution.enabled ? "on" : "off");
+    ImGui::Text("O hides, T writes %s, R toggles dynamic resolution", TIMINGS_FILE);
+    ImGui::End();
 }
 
 // utility function for loading a 2D texture from file